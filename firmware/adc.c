@@ -25,7 +25,9 @@
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 #include "adc.h"
+#include "trace.h"
 
 #define ADC_SELECT_CHANNEL(pin)    (ADMUX = (ADMUX & 0xF0) | pin)
 #define ADC_START_CONVERSION()     (ADCSRA |= _BV(ADSC))
@@ -37,6 +39,8 @@ static volatile struct
 	int noise_reduce;
 	adc_cb_t cb;
 	int channel;
+	uint8_t tag;
+	uint8_t hold;   // set while adc_read() polls, adc_trigger() backs off
 } adc_ctx;
 
  // ADC conversion complete
@@ -44,17 +48,20 @@ ISR(ADC_vect)
 {
 	int ret = -1;
 	uint16_t value = ADC;
-	
+
+	TRACE_EVENT(TRACE_IRQ_IN, TRACE_V_ADC);
+	// NULL for a polled adc_read(), which takes the value itself
 	if (adc_ctx.cb != NULL)
-		ret = adc_ctx.cb(adc_ctx.channel, value);
+		ret = adc_ctx.cb(adc_ctx.channel, value, adc_ctx.tag);
 
 	if (ret >= 0) {
 		adc_ctx.channel = ret;
 		ADC_SELECT_CHANNEL(ret);
 		ADC_START_CONVERSION();
-	} else {
+	} else if (adc_ctx.tag == ADC_TAG_NONE) {
 		ADC_DISABLE();
 	}
+	TRACE_EVENT(TRACE_IRQ_OUT, TRACE_V_ADC);
 }
 
 /**
@@ -66,7 +73,7 @@ void adc_init(adc_ref_t ref, adc_prescaler_t prescaler, int opts)
 	// set conversion complete IRQ and prescaler
 	ADCSRA = _BV(ADIE) | prescaler;
 	// select ADC reference source
-	ADMUX = prescaler << 6;
+	ADMUX = ref << 6;
 
 	if (opts & _BV(ADC_NOISE_REDUCTION))
 		adc_ctx.noise_reduce |= _BV(ADC_NOISE_REDUCTION);
@@ -80,7 +87,8 @@ void adc_init(adc_ref_t ref, adc_prescaler_t prescaler, int opts)
  */
 inline void adc_deinit(void)
 {
-	ADC_DISABLE();
+	// stops a conversion in progress and powers the ADC down
+	ADCSRA = 0;
 }
 
 /**
@@ -92,6 +100,9 @@ inline void adc_deinit(void)
  * conversion is complete. 
  
  * If cb is NULL then adc_read() waits until the conversion is complete.
+ * Meanwhile adc_trigger() doesn't start conversions; a triggered one
+ * or a chained one which completed but whose IRQ hasn't run yet is
+ * dropped.
  *
  * @param[in] channel ADC channel which should be sampled
  * @param[in] cb a pointer to callback funcion which should be called
@@ -100,7 +111,42 @@ inline void adc_deinit(void)
 uint16_t adc_read(int channel, adc_cb_t cb)
 {
 	uint16_t value = UINT16_MAX;
-	
+
+	if (cb == NULL) {
+		uint8_t started = 0;
+
+		// the mux IRQ's adc_trigger() would change the channel between
+		// the selection and the end of the conversion
+		adc_ctx.hold = 1;
+		while (!started) {
+			while (ADCSRA & _BV(ADSC))
+				;
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				// the IRQ may have chained another conversion meanwhile
+				if (!(ADCSRA & _BV(ADSC))) {
+					// writing ADIF clears the flag of a conversion whose
+					// IRQ would otherwise see the polled context
+					ADCSRA |= _BV(ADEN) | _BV(ADIF);
+					ADC_SELECT_CHANNEL(channel);
+					adc_ctx.channel = channel;
+					adc_ctx.tag = ADC_TAG_NONE;
+					adc_ctx.cb = NULL;
+					ADC_START_CONVERSION();
+					started = 1;
+				}
+			}
+		}
+		while (ADCSRA & _BV(ADSC))
+			;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			value = ADC;
+			// clears ADIF too, if the IRQ hasn't run yet
+			ADC_DISABLE();
+			adc_ctx.hold = 0;
+		}
+		return value;
+	}
+
 	// if ADC is enabled then wait for the current 
 	// conversion to complete (if there is one in progress)
 	if (ADCSRA & _BV(ADEN)) {
@@ -110,22 +156,45 @@ uint16_t adc_read(int channel, adc_cb_t cb)
 	}
 
 	ADC_SELECT_CHANNEL(channel);
+	adc_ctx.channel = channel;
+	adc_ctx.tag = ADC_TAG_NONE;
+	adc_ctx.cb = cb;
 
-	if (cb != NULL) {
-		adc_ctx.cb = cb;
-		if (adc_ctx.noise_reduce) {
-			set_sleep_mode(SLEEP_MODE_ADC);
-			sleep_mode();
-		} else {
-			ADC_START_CONVERSION();
-		}
+	if (adc_ctx.noise_reduce) {
+		set_sleep_mode(SLEEP_MODE_ADC);
+		sleep_mode();
 	} else {
 		ADC_START_CONVERSION();
-		while (ADCSRA & _BV(ADSC))
-			;
-		ADC_DISABLE();
-		value = ADC;
 	}
 
 	return value;
 }
+
+/**
+ * @brief Start a conversion at a given moment.
+ *
+ * Meant to be called from a timer IRQ, so that samples are taken at a
+ * fixed phase of whatever disturbs them. Doesn't wait: if a conversion
+ * is still in progress this one is skipped. The ADC is left enabled
+ * afterwards, so the next conversion doesn't take the 25 cycle start-up
+ * path and the sample is taken 1.5 ADC cycles after the call. Nothing is
+ * started while adc_read() polls.
+ *
+ * @param[in] channel ADC channel which should be sampled
+ * @param[in] tag passed on to the callback
+ * @param[in] cb callback called from IRQ context with the result
+ * @return 1 if the conversion was started
+ */
+uint8_t adc_trigger(int channel, uint8_t tag, adc_cb_t cb)
+{
+	if (adc_ctx.hold || (ADCSRA & _BV(ADSC)))
+		return 0;
+
+	ADC_SELECT_CHANNEL(channel);
+	adc_ctx.channel = channel;
+	adc_ctx.tag = tag;
+	adc_ctx.cb = cb;
+	ADCSRA |= _BV(ADEN) | _BV(ADSC);
+
+	return 1;
+}
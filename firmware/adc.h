@@ -19,19 +19,24 @@
  *
  */
 
+// tag of conversions started by adc_read()
+#define ADC_TAG_NONE    0xFF
+
 /**
  * @brief ADC conversion complete callback.
  *
  * An ADC callback is called from ADC IRQ context when passed as an 
- * argument to adc_read() function.
+ * argument to adc_read() or adc_trigger() function.
  *
  * @param[in] channel channel number which was sampled during the conversion
  * @param[in] value value of ADC conversion
+ * @param[in] tag tag passed to adc_trigger(), ADC_TAG_NONE for adc_read()
  * @return the function returns a channel number which will be sampled during next
            conversion cycle or -1 if no more conversions are required. If -1 is returned
-		   then ADC module is disabled to reduce energy consumption.
+		   then ADC module is disabled to reduce energy consumption, unless the
+		   conversion was started by adc_trigger().
  */
-typedef int (*adc_cb_t)(int channel, uint16_t value);
+typedef int (*adc_cb_t)(int channel, uint16_t value, uint8_t tag);
 
 /**
  * @brief ADC voltage reference source
@@ -55,6 +60,13 @@ typedef enum {
 	ADC_PRE128 = 7
 } adc_prescaler_t;
 
+/**
+ * @brief ADC options
+ *
+ * Note that the noise reduction sleep mode halts clkIO and with it the
+ * Timer1 PWM output, in whatever state it is. Don't use it while the
+ * SMPS is running.
+ */
 typedef enum {
 	ADC_NOISE_REDUCTION = 1,
 	ADC_LEFT_ADJUST     = 2,
@@ -74,3 +86,4 @@ void adc_init(adc_ref_t ref, adc_prescaler_t prescaler, int opts);
 void adc_deinit(void);
 
 uint16_t adc_read(int channel, adc_cb_t cb);
+uint8_t adc_trigger(int channel, uint8_t tag, adc_cb_t cb);
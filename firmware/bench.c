@@ -0,0 +1,123 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "bench.h"
+
+#if BENCH == 1
+
+static struct {
+	uint8_t tccr1a;
+	uint8_t tccr1b;
+	uint16_t overhead;
+} bench;
+
+static void __attribute__((noinline)) empty(void)
+{
+	asm volatile ("");
+}
+
+/**
+ * Time one call of fn with IRQs masked. TCNT1L is read first, which
+ * latches the whole count, so an IRQ enabled by fn (e.g. by the reti of
+ * an ISR called directly) can't get into the reading.
+ */
+static uint16_t bench_once(bench_fn_t fn)
+{
+	uint8_t sreg = SREG;
+	uint16_t start, end;
+
+	cli();
+	start = TCNT1;
+	fn();
+	end = TCNT1;
+	SREG = sreg;
+
+	return end - start;
+}
+
+/**
+ * @brief Borrow Timer1 as a cycle counter.
+ *
+ * Stops the SMPS and measures the cost of a call for bench_run().
+ */
+void bench_begin(void)
+{
+	bench.tccr1a = TCCR1A;
+	bench.tccr1b = TCCR1B;
+
+	// normal mode, OC1A disconnected, no prescaling
+	TCCR1B = 0;
+	TCCR1A = 0;
+	TCNT1 = 0;
+	TCCR1B = _BV(CS10);
+
+	bench.overhead = UINT16_MAX;
+	for (uint8_t i = 0; i < BENCH_RUNS; i++) {
+		uint16_t cycles = bench_once(empty);
+		if (cycles < bench.overhead)
+			bench.overhead = cycles;
+	}
+}
+
+/**
+ * @brief Give Timer1 back to the SMPS, in the state bench_begin() found it.
+ *
+ * Must not be called if someone else took Timer1 over in between, e.g.
+ * pwr_fail().
+ */
+void bench_end(void)
+{
+	TCCR1B = 0;
+	TCCR1A = bench.tccr1a;
+	// below TOP, or the PWM would count up to 0xFFFF with the switch on
+	TCNT1 = 0;
+	TCCR1B = bench.tccr1b;
+}
+
+/**
+ * @brief Time BENCH_RUNS calls of fn.
+ *
+ * @param[in] fn code under test
+ * @param[out] result cycles, without the cost of the call
+ */
+void bench_run(bench_fn_t fn, bench_result_t *result)
+{
+	uint32_t sum = 0;
+
+	result->min = UINT16_MAX;
+	result->max = 0;
+
+	for (uint8_t i = 0; i < BENCH_RUNS; i++) {
+		uint16_t cycles = bench_once(fn) - bench.overhead;
+
+		if (cycles < result->min)
+			result->min = cycles;
+		if (cycles > result->max)
+			result->max = cycles;
+		sum += cycles;
+	}
+
+	result->avg = sum / BENCH_RUNS;
+}
+
+#endif
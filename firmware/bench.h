@@ -0,0 +1,68 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <inttypes.h>
+
+/**
+ * On-target microbenchmarks for the `bench` command, in CPU cycles. They
+ * run on the real board, with its asynchronous Timer2 and ADC clock,
+ * which tools/isrbench can only model, so hardware revisions and builds
+ * can be compared in the field.
+ *
+ * Timer1 is borrowed as the cycle counter, so the SMPS is off between
+ * bench_begin() and bench_end(). Every run is timed with IRQs masked
+ * (unless the code under test enables them itself) and the cost of the
+ * call is taken out, so an empty function comes out as 0. A run must stay
+ * below 65536 cycles (8ms).
+ *
+ * Build with BENCH=1.
+ */
+
+#ifndef BENCH
+#define BENCH           0
+#endif
+
+// runs per benchmark
+#ifndef BENCH_RUNS
+#define BENCH_RUNS      16
+#endif
+
+/**
+ * @brief Code under test
+ */
+typedef void (*bench_fn_t)(void);
+
+/**
+ * @brief Cycles of a benchmark over BENCH_RUNS runs
+ */
+typedef struct {
+	uint16_t min;
+	uint16_t max;
+	uint16_t avg;
+} bench_result_t;
+
+void bench_begin(void);
+void bench_end(void);
+void bench_run(bench_fn_t fn, bench_result_t *result);
+
+#endif
@@ -0,0 +1,177 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <string.h>
+#include <avr/io.h>
+#include "minixie.h"
+#include "uart.h"
+#include "dcf77.h"
+#include "frame.h"
+#include "chain.h"
+
+#define SECONDS_PER_DAY     86400UL
+
+chain_t chain;
+
+static uint8_t period;
+static uint8_t div;
+
+/**
+ * Add a fraction of a second to a chain time.
+ */
+static void advance(chain_time_t *t, uint32_t frac)
+{
+	uint32_t phase = t->phase + frac;
+	uint32_t sod = t->hh * 3600UL + t->mm * 60 + t->ss + (phase >> 16);
+
+	sod %= SECONDS_PER_DAY;
+	t->hh = sod / 3600;
+	t->mm = sod / 60 % 60;
+	t->ss = sod % 60;
+	t->phase = phase;
+}
+
+/**
+ * Send a time frame, the caller checks that TX is idle.
+ */
+static void send(const chain_time_t *t)
+{
+	if (frame_write(FRAME_TIME, t, sizeof(*t)))
+		chain.tx++;
+	else
+		chain.busy++;
+}
+
+/**
+ * @brief Set the role, see chain_role_t
+ */
+void chain_init(uint8_t role)
+{
+	chain.role = role;
+	div = 0;
+
+	// a follower only listens to the chain
+	dcf77_enable(role != CHAIN_FOLLOWER);
+}
+
+/**
+ * @brief Note a successful sync, e.g. from DCF77.
+ */
+void chain_synced(void)
+{
+	rtc_stamp_t now;
+
+	rtc_snapshot(&now, NULL);
+	chain.last_sync = now.seconds;
+	chain.synced = 1;
+}
+
+/**
+ * @brief Broadcast the time if this is the master, call once a second.
+ */
+void chain_second(void)
+{
+	rtc_stamp_t stamp;
+	clock_t now;
+	chain_time_t t;
+	uint32_t age;
+
+	if (chain.role != CHAIN_MASTER || !chain.synced || ++period < CHAIN_PERIOD)
+		return;
+	period = 0;
+
+	if (!uart_tx_idle(FRAME_UART)) {
+		chain.busy++;
+		return;
+	}
+
+	rtc_snapshot(&stamp, &now);
+	age = (stamp.seconds - chain.last_sync) / 60;
+
+	t.hh = now.hh;
+	t.mm = now.mm;
+	t.ss = now.ss;
+	t.phase = stamp.subticks << 8;
+	t.hops = 0;
+	t.age = age > 255 ? 255 : age;
+	send(&t);
+}
+
+/**
+ * @brief Handle a time frame from upstream.
+ *
+ * Forwards the frame and disciplines the RTC to it.
+ *
+ * @param[in] frame received frame
+ * @return 1 if the RTC trim has been updated, 0 otherwise
+ */
+uint8_t chain_frame(const frame_rx_t *frame)
+{
+	chain_time_t t;
+
+	if (chain.role != CHAIN_FOLLOWER || frame->type != FRAME_TIME || frame->len != sizeof(t))
+		return 0;
+
+	memcpy(&t, frame->payload, sizeof(t));
+	if (t.hh > 23 || t.mm > 59 || t.ss > 59)
+		return 0;
+
+	chain.rx++;
+	chain.hops = t.hops;
+	chain.age = t.age;
+
+	// the reference time when the SOF arrived
+	advance(&t, CHAIN_BYTE_TIME);
+
+	// forward first, rtc_discipline() may wait for a tick
+	if (t.hops < CHAIN_MAX_HOPS) {
+		if (uart_tx_idle(FRAME_UART)) {
+			chain_time_t fwd = t;
+			rtc_stamp_t now;
+
+			rtc_snapshot(&now, NULL);
+			fwd.hops++;
+			advance(&fwd, ((now.seconds - frame->stamp.seconds) * RTC_TICKS_PER_SEC +
+						   now.subticks - frame->stamp.subticks) << 8);
+			send(&fwd);
+		} else {
+			chain.busy++;
+		}
+	}
+
+	if (chain.syncs && ++div < CHAIN_SYNC)
+		return 0;
+	div = 0;
+
+	// round to the nearest tick
+	advance(&t, 128);
+	clock_t ref = {
+		.hh = t.hh,
+		.mm = t.mm,
+		.ss = t.ss,
+	};
+
+	chain.syncs++;
+	chain.last_sync = frame->stamp.seconds;
+	chain.synced = 1;
+
+	return rtc_discipline(&frame->stamp, &ref, t.phase >> 8);
+}
@@ -0,0 +1,113 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _CHAIN_H_
+#define _CHAIN_H_
+
+#include <inttypes.h>
+#include "rtc.h"
+#include "frame.h"
+
+/**
+ * Several clocks can share one DCF77 receiver by daisy-chaining their
+ * UARTs: TX of one clock to RX of the next. The master, the clock with
+ * the receiver, sends a FRAME_TIME frame every CHAIN_PERIOD seconds once
+ * it has synced. Every follower time stamps the frame as it arrives,
+ * forwards it downstream with the time it held the frame added, and
+ * disciplines its RTC to it every CHAIN_SYNC frames, the first one
+ * right away. The DCF77 input of a follower is off.
+ *
+ * Frames are only sent when the TX queue is empty, so their SOF goes out
+ * right after the time was taken: the receiver's stamp is then one byte
+ * time late, which is added per hop. The phase is carried in 1/65536s so
+ * that the sub-tick per-hop corrections add up instead of being lost.
+ *
+ * The time a follower holds a frame is taken from two RTC stamps, which
+ * are both truncated to 1/256s ticks. Each hop thus adds an error of less
+ * than one tick (3.9ms), in either direction. The errors of the hops are
+ * independent and mostly cancel out, but at the end of a chain of
+ * CHAIN_MAX_HOPS followers they are bounded by 15 ticks (59ms) only. A
+ * follower's stamp of the SOF it disciplines its RTC to is truncated the
+ * same way, which adds up to one more tick.
+ *
+ * The line also carries the log output and the console echo of the clock
+ * upstream. A follower takes no console commands: all text it receives
+ * is dropped, only the frames are used. Build with CHAIN=1 and select
+ * the role with the `chain` command; a follower powered up with both
+ * buttons held starts with the chain off and takes commands again.
+ */
+
+#ifndef CHAIN_PERIOD
+#define CHAIN_PERIOD        1               // in s
+#endif
+
+#ifndef CHAIN_SYNC
+#define CHAIN_SYNC          16              // frames per rtc_discipline()
+#endif
+
+#define CHAIN_MAX_HOPS      15
+
+// one byte (10 bits) on the wire, in 1/65536s
+#define CHAIN_BYTE_TIME     ((65536UL*10 + UART_BAUD_RATE/2)/UART_BAUD_RATE)
+
+/**
+ * @brief Chain roles
+ */
+typedef enum {
+	CHAIN_OFF,
+	CHAIN_MASTER,
+	CHAIN_FOLLOWER,
+} chain_role_t;
+
+/**
+ * @brief FRAME_TIME payload
+ */
+typedef struct {
+	uint8_t hh;
+	uint8_t mm;
+	uint8_t ss;
+	uint16_t phase;     /**< fraction of the second in 1/65536s */
+	uint8_t hops;       /**< followers the frame went through */
+	uint8_t age;        /**< minutes since the master's last sync, saturated */
+} __attribute__((packed)) chain_time_t;
+
+/**
+ * @brief Chain state and counters
+ */
+typedef struct {
+	uint8_t role;       /**< chain_role_t */
+	uint8_t hops;       /**< hops of the last frame received */
+	uint8_t age;        /**< age of the last frame received */
+	uint16_t rx;        /**< frames received */
+	uint16_t tx;        /**< frames sent or forwarded */
+	uint16_t busy;      /**< frames not sent because TX was busy */
+	uint16_t syncs;     /**< rtc_discipline() calls */
+	uint32_t last_sync; /**< last sync (DCF77 or chain), in rtc seconds */
+	uint8_t synced;     /**< set once last_sync is valid */
+} chain_t;
+
+extern chain_t chain;
+
+void chain_init(uint8_t role);
+void chain_synced(void);
+void chain_second(void);
+uint8_t chain_frame(const frame_rx_t *frame);
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stddef.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "minixie.h"
+#include "config.h"
+
+static config_t config_ee EEMEM;
+
+config_t config;
+
+static const config_t config_default = {
+	.magic = CONFIG_MAGIC,
+	.version = CONFIG_VERSION,
+	.rtc_trim = 0,
+	.brightness = BRI_MAX,
+	.tube_trim = {0},
+	.night_light = 0,
+	.night_dwell = 10,
+	.night_from = 0,
+	.night_to = 0,
+	.chain = 0,
+	.smps_khz = 0,
+	.smps_dc = 0,
+};
+
+static uint16_t config_crc(const config_t *c)
+{
+	const uint8_t *bp = (const uint8_t *)c;
+	uint16_t crc = 0xFFFF;
+
+	for (uint8_t i = 0; i < offsetof(config_t, crc); i++)
+		crc = _crc_ccitt_update(crc, bp[i]);
+
+	return crc;
+}
+
+/**
+ * @brief Load settings from EEPROM, fall back to defaults if they are invalid.
+ */
+void config_load(void)
+{
+	eeprom_read_block(&config, &config_ee, sizeof(config));
+
+	if (config.magic != CONFIG_MAGIC || config.version != CONFIG_VERSION ||
+		config.crc != config_crc(&config)) {
+		config = config_default;
+	}
+}
+
+/**
+ * @brief Store settings in EEPROM.
+ *
+ * Only the bytes which changed are written.
+ */
+void config_save(void)
+{
+	config.crc = config_crc(&config);
+	eeprom_update_block(&config, &config_ee, sizeof(config));
+}
@@ -0,0 +1,62 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include <inttypes.h>
+
+/**
+ * Settings which survive a reset are kept in EEPROM. The block is
+ * protected by a CRC and tagged with a layout version; a block which
+ * fails either check is replaced with the defaults. Bump CONFIG_VERSION
+ * whenever config_t changes.
+ */
+
+#define CONFIG_MAGIC    0x4D58          // "MX"
+#define CONFIG_VERSION  5
+
+/**
+ * @brief Persistent settings
+ */
+typedef struct {
+	uint16_t magic;
+	uint8_t version;
+
+	int16_t rtc_trim;       /**< RTC frequency trim, see rtc_set_trim() */
+	uint8_t brightness;     /**< tube brightness, 0..BRI_MAX */
+	int8_t tube_trim[4];    /**< per tube brightness trim in % */
+	uint16_t night_light;   /**< light ADC reading above which it is dark, 0 = off */
+	uint8_t night_dwell;    /**< minutes of darkness before the tubes sleep */
+	uint8_t night_from;     /**< hour the night window starts */
+	uint8_t night_to;       /**< hour the night window ends, equal to night_from = off */
+	uint8_t chain;          /**< chain role, see chain_role_t */
+	uint8_t smps_khz;       /**< SMPS PWM frequency, 0 = SMPS_PWM_FREQ, see 'smps tune' */
+	uint8_t smps_dc;        /**< SMPS duty cycle, 0 = SMPS_PWM_DC */
+
+	uint16_t crc;
+} config_t;
+
+extern config_t config;
+
+void config_load(void);
+void config_save(void);
+
+#endif
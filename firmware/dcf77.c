@@ -3,21 +3,15 @@
  *
  * About this program:
  * This is a decoder of the German 77.5KHz time code "DCF77".
- * The decoder is quite flexible in its design and can quite easy be
- * modified for your own purposes. It is built basically by one state
- * machine and a simple command parser, the state machine handles the
- * timing of the pulse width moduleated bits including the sync bit.
- * Then the command parser decodes the bits into a meaningful data
- * structure, each command has information on how many bits to decode
- * and if parity shall be counted and most important, how it shall be
- * decoded. If you only want part of the timecode then you can change
- * the struct and some of the decoding commands to ignore commands to
- * be able to get smaller memory footprint. This program was intended
- * to run on an AVR MCU but could easily be fitted for any MCU.
- * The decoder is intended to be polled at the frequency defined in
- * the dcf77.h file but you can quite easily change it to be interrupt
- * driven if you have a hardware timer that can replace the
- * "period_timer"-variable.
+ * It is split in two parts. A state machine, run on every edge of the
+ * receiver output, handles the timing of the pulse width modulated bits
+ * including the sync gap and shifts the bits into a 64-bit frame. At
+ * the minute mark the complete frame is handed over to dcf77_decode(),
+ * which runs outside of interrupt context once a minute and checks and
+ * extracts all fields of the frame at once using word-wide operations.
+ *
+ * (Minixie: the original command list interpreter has been replaced
+ * with the frame register and the word-wide decoder.)
  *                 
  * For more info:                                          
  * see www.rickard.gunee.com/projects            
@@ -39,50 +33,77 @@
  */
 
 #include <avr/io.h>
+#include <util/atomic.h>
+#include "rtc.h"
 #include "dcf77.h"
-
-unsigned char bcd_weigts[8] = {1,2,4,8,10,20,40,80};
+#include "trace.h"
 
 dcf_time_t dcf_time;
+dcf_frame_t dcf_frame;
+rtc_stamp_t dcf_mark;
 unsigned char dcf_state = DCF_S_WAIT;
+dcf_stats_t dcf_stats;
+volatile unsigned char dcf_polled = 0;
+
+// input filter state, shared by dcf77_edge(), dcf77_poll() and
+// dcf77_second(); the callers run nested and may preempt each other, so
+// it is only touched with the interrupts disabled
+static struct
+{
+	unsigned char	stable;		// last confirmed level
+	unsigned char	pending;	// set if an edge waits for confirmation
+	unsigned char	level;		// level after the pending edge
+	unsigned short	time;		// raw tick time of the pending edge
+	rtc_stamp_t		stamp;		// disciplined time of the pending edge
+	unsigned char	rate;		// raw edges in the current second
+	unsigned char	quiet;		// quiet seconds while polled
+	unsigned char	div;		// poll divider
+	unsigned char	integ;		// poll integrator
+	unsigned char	raw;		// last polled sample
+	unsigned char	polled;		// polled level
+} flt;
 
-// list of bytes that define how to decode dcf bit stream
-//
-// The following format is used for the command bytes:
-// bit		function
-// 0..3		number of bits
-// 4..6		decode command
-// 7		count parity for bits
+// extract a bit field from a 32-bit word
+#define FIELD(w, pos, len)	(((w) >> (pos)) & ((1UL << (len)) - 1))
 
-unsigned char dcf_cmd_list[] =
+// frame layout
+#define DCF_B_ZERO				0	// start of minute, always 0
+#define DCF_B_FLAGS				15	// call bit, A1, Z1, Z2, A2, S
+#define DCF_B_START_OF_TIME		20	// always 1
+
+// even parity of a 32-bit word, folded down to a nibble
+static unsigned char parity(uint32_t w)
 {
-	DCF_CMD_ZERO	| 1,
-	DCF_CMD_IGNORE	| 14,
-	DCF_CMD_BIN		| 6	,
-	DCF_CMD_BCD		| 7		|	DCF_PARITY_COUNT,
-	DCF_CMD_PCHECK	| 1	,
-	DCF_CMD_BCD		| 6		|	DCF_PARITY_COUNT,
-	DCF_CMD_PCHECK	| 1	,	
-	DCF_CMD_BCD		| 6		|	DCF_PARITY_COUNT,
-	DCF_CMD_BCD		| 3		|	DCF_PARITY_COUNT,	
-	DCF_CMD_BCD		| 5		|	DCF_PARITY_COUNT,	
-	DCF_CMD_BCD		| 8		|	DCF_PARITY_COUNT,	
-	DCF_CMD_PCHECK	| 1	,
-	DCF_CMD_END
-};
-
-extern unsigned short timer;
-
-unsigned int dcf77_handler(void)
+	w ^= w >> 16;
+	w ^= w >> 8;
+	w ^= w >> 4;
+	return (0x6996 >> (w & 0x0F)) & 1;
+}
+
+// convert a BCD field, 0xFF if any digit is not decimal
+static unsigned char bcd(uint32_t v)
 {
-	static unsigned char parity,data,pos,cnt,*cmd;
+	unsigned char lo = v & 0x0F;
+	unsigned char hi = v >> 4;
 
-	static dcf_time_t dcf_time_buff;
-	static unsigned char *time_output;
-	unsigned char dcf_time_ok = 0;
+	if (lo > 9 || hi > 9)
+		return 0xFF;
+
+	return hi * 10 + lo;
+}
+
+/**
+ * Pulse timing state machine, run for every edge which passed the input
+ * filter. The level and times are those of the edge itself.
+ */
+static unsigned char dcf77_handler(unsigned char level, unsigned short now, const rtc_stamp_t *stamp)
+{
+	static dcf_frame_t buff;
+	static unsigned char pos;
+	unsigned char events = 0;
 
 	static unsigned short last_time = 0;
-	unsigned short period_timer = (timer | TCNT2) - last_time;
+	unsigned short period_timer = now - last_time;
 
 
 	unsigned char next_dcf_state = dcf_state;
@@ -90,95 +111,62 @@ unsigned int dcf77_handler(void)
 	{
 		// reading data, dcf bit is low, waiting to get high to get next bit
 		case DCF_S_DATA_L:
-			// if we have waited too long, abort and wait for next sync and try again				
-			if(period_timer > DCF_TIME_L_MAX)
-				next_dcf_state = DCF_S_ERROR;
-			
-			// if we get a high bit start reading data
-			if(dcf_pin)
-				next_dcf_state = DCF_S_DATA_H;
-				
+			if(level)
+			{
+				if(period_timer > DCF_TIME_SYNC_MIN)
+				{
+					// the missing 59th second pulse, this edge is the minute mark
+					dcf_mark = *stamp;
+					events |= DCF_EV_MARK;
+
+					if(pos == DCF_FRAME_BITS || pos == DCF_FRAME_BITS + 1)
+					{
+						dcf_frame = buff;				// hand the frame over to the decoder
+						events |= DCF_EV_FRAME;
+					}
+
+					buff.bits = 0;
+					pos = 0;
+					next_dcf_state = DCF_S_DATA_H;
+				}
+				// if we have waited too long, abort and wait for next sync and try again
+				else if(period_timer > DCF_TIME_L_MAX)
+					next_dcf_state = DCF_S_ERROR;
+				else
+					next_dcf_state = DCF_S_DATA_H;
+			}
 			break;
 
 
-		// reading data, dcf bit is high, waiting to get high to get low to determine if 1 or 0
+		// reading data, dcf bit is high, waiting to get low to determine if 1 or 0
 		case DCF_S_DATA_H:
-			if(period_timer > DCF_TIME_H_MAX)
-				next_dcf_state = DCF_S_ERROR;
-				
-			if(!dcf_pin)
+			if(!level)
 			{
-				if(period_timer < DCF_TIME_L_MIN)
+				if(period_timer < DCF_TIME_L_MIN || period_timer > DCF_TIME_H_MAX || pos > DCF_FRAME_BITS)
 					next_dcf_state = DCF_S_ERROR;
 				else
 				{
-					unsigned char bit = (period_timer > DCF_TIME_L);
+					// shift the bit into the frame
+					if(period_timer > DCF_TIME_L)
+						buff.bytes[pos >> 3] |= 1 << (pos & 7);
+					pos++;
 					next_dcf_state = DCF_S_DATA_L;
-					
-					if(*cmd & DCF_PARITY_COUNT)
-						parity+=bit;
-
-					switch(*cmd & DCF_CMD_MASK)
-					{
-						case DCF_CMD_BCD:
-							data += bit?bcd_weigts[pos]:0; //bcd - each bit shall be weighted
-							pos++;
-							break;
-
-						case DCF_CMD_BIN:
-							data = (data<<1) | bit;	// binary - just shift in the bits
-							break;
-
-						case DCF_CMD_PCHECK:
-							if((parity&1)!=bit)		// check if parity is same as bit
-								next_dcf_state = DCF_S_ERROR;
-							parity=0;
-							break;
-
-						case DCF_CMD_ZERO:
-							if(bit)				// must be zero
-								next_dcf_state = DCF_S_ERROR;
-							break;
-
-						case DCF_CMD_IGNORE:	// if bit is to be ignored, do nothing
-						default:
-							break;
-					}
-					
-					if(!--cnt)
-					{
-						if(*cmd & DCF_CMD_STORE_BIT)
-							*(time_output++) = data;	// write data and point at next position
-							
-						cmd++;								// point at next command byte
-						cnt		= *cmd & DCF_COUNTER_MASK;	// get number of bits for this command to read
-						data	= 0;						// clear data buffer to read next byte
-						pos		= 0;
-							
-						if((*cmd & DCF_CMD_MASK) == DCF_CMD_END)	// if time info was completely read
-						{
-							dcf_time_ok = 1;			    // keep track on last dcf time update
-							dcf_time = dcf_time_buff;		// then store successful result
-							next_dcf_state = DCF_S_WAIT;	// and start reading next time information
-						}
-					}
-				}	
+				}
 			}
 			break;
 			
 		// sync, dcf bit is low, waiting for it to get high
 		case DCF_S_SYNC:
 		
-			if(dcf_pin) // if dcf gets high and low period was long enough
+			if(level) // if dcf gets high and low period was long enough
 			{
 				if(period_timer > DCF_TIME_SYNC_MIN)
 				{
+					dcf_mark = *stamp;				// this edge is the minute mark
+					events |= DCF_EV_MARK;
+					buff.bits = 0;
+					pos = 0;
 					next_dcf_state = DCF_S_DATA_H;
-					parity	= 0;
-					cmd = dcf_cmd_list;
-					cnt = *cmd & DCF_COUNTER_MASK;
-					time_output = (unsigned char *) &dcf_time_buff.flags;
-					
 				}
 				else
 					next_dcf_state = DCF_S_WAIT;
@@ -187,15 +175,226 @@ unsigned int dcf77_handler(void)
 
 		case DCF_S_WAIT:
 		default:		
-			if(!dcf_pin)
+			if(!level)
 				next_dcf_state = DCF_S_SYNC;
 	}
 	
 	if(dcf_state != next_dcf_state)
 	{
+		TRACE_EVENT(TRACE_DCF_STATE, next_dcf_state);
 		dcf_state = next_dcf_state;
-		last_time = timer | TCNT2;
+		last_time = now;
+	}
+
+	return events;
+}
+
+/**
+ * Glitch filter. An edge is passed on to the state machine, together with
+ * its original time, only once the level has been stable for at least
+ * DCF_GLITCH_MIN ticks, i.e. when the next edge comes late enough. Both
+ * edges of a shorter pulse are dropped.
+ */
+static unsigned char dcf77_input(unsigned char level, unsigned short now, const rtc_stamp_t *stamp)
+{
+	unsigned char events = 0;
+
+	if(flt.pending)
+	{
+		flt.pending = 0;
+		if((unsigned short)(now - flt.time) < DCF_GLITCH_MIN)
+			dcf_stats.glitches++;
+		else
+		{
+			events = dcf77_handler(flt.level, flt.time, &flt.stamp);
+			flt.stable = flt.level;
+		}
+	}
+
+	if(level != flt.stable)
+	{
+		flt.pending = 1;
+		flt.level = level;
+		flt.time = now;
+		flt.stamp = *stamp;
 	}
 
-	return dcf_time_ok;
+	return events;
+}
+
+/**
+ * Edge interrupt handler. Masks the interrupt and switches over to
+ * polling when more than DCF_EDGE_LIMIT edges arrive within a second.
+ *
+ * Returns DCF_EV_* events.
+ */
+unsigned char dcf77_edge(void)
+{
+	rtc_stamp_t stamp;
+	unsigned short now = rtc_ticks();
+	unsigned char events;
+
+	rtc_snapshot(&stamp, 0);
+
+	// once dcf_polled is set the mux IRQ may run dcf77_poll()
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		dcf_stats.edges++;
+
+		if(++flt.rate > DCF_EDGE_LIMIT)
+		{
+			DCF_IRQ_OFF();
+			dcf_polled = 1;
+			dcf_stats.storms++;
+			TRACE_EVENT(TRACE_DCF_STORM, 0);
+			TRACE_TRIGGER(TRACE_T_STORM);
+			flt.quiet = 0;
+			flt.raw = flt.polled = flt.stable;
+			flt.integ = flt.stable ? DCF_POLL_SAMPLES : 0;
+		}
+
+		events = dcf77_input(dcf_pin ? 1 : 0, now, &stamp);
+	}
+
+	return events;
+}
+
+/**
+ * Polling handler, called from a periodic interrupt while dcf_polled is
+ * set. Samples the input at DCF_HANDLER_FREQ through an integrator which
+ * needs DCF_POLL_SAMPLES equal samples to change the level; the edge is
+ * dated back by that many ticks.
+ *
+ * Returns DCF_EV_* events.
+ */
+unsigned char dcf77_poll(void)
+{
+	unsigned char sample = dcf_pin ? 1 : 0;
+	unsigned char events = 0;
+
+	// the divider is private to the caller
+	if(++flt.div < DCF_POLL_DIV)
+		return 0;
+	flt.div = 0;
+
+	// dcf77_second() may hand the input back to the edge IRQ meanwhile
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(sample != flt.raw)
+		{
+			flt.raw = sample;
+			flt.rate++;
+		}
+
+		if(sample)
+		{
+			if(flt.integ < DCF_POLL_SAMPLES)
+				flt.integ++;
+		}
+		else if(flt.integ > 0)
+			flt.integ--;
+
+		if((flt.integ == DCF_POLL_SAMPLES && !flt.polled) || (flt.integ == 0 && flt.polled))
+		{
+			rtc_stamp_t stamp;
+
+			flt.polled ^= 1;
+			rtc_snapshot(&stamp, 0);
+			if(stamp.subticks >= DCF_POLL_SAMPLES)
+				stamp.subticks -= DCF_POLL_SAMPLES;
+			else
+			{
+				stamp.subticks += DCF_HANDLER_FREQ - DCF_POLL_SAMPLES;
+				stamp.seconds--;
+			}
+			events = dcf77_input(flt.polled, rtc_ticks() - DCF_POLL_SAMPLES, &stamp);
+		}
+	}
+
+	return events;
+}
+
+/**
+ * Enable or disable the receiver input. The decoder starts over from
+ * hunting for the minute mark when enabled.
+ */
+void dcf77_enable(unsigned char on)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		DCF_IRQ_OFF();
+		dcf_polled = 0;
+		flt.pending = 0;
+		flt.rate = 0;
+		dcf_state = DCF_S_WAIT;
+
+		if(on)
+			DCF_IRQ_ON();
+	}
+}
+
+/**
+ * Once a second housekeeping. Re-enables the edge interrupt once the
+ * input has been quiet for DCF_STORM_HOLD seconds.
+ */
+void dcf77_second(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(dcf_polled)
+		{
+			if(flt.rate > DCF_EDGE_LIMIT)
+				flt.quiet = 0;
+			else if(++flt.quiet >= DCF_STORM_HOLD)
+			{
+				dcf_polled = 0;
+				DCF_IRQ_ON();
+			}
+		}
+
+		flt.rate = 0;
+	}
+}
+
+/**
+ * Decode a complete frame. The frame is split into two 32-bit words
+ * covering the time (bits 16..47) and the date (bits 32..63); parity
+ * checks and field extraction work on whole words.
+ *
+ * Returns 1 and fills in time if the frame is valid, 0 otherwise.
+ */
+unsigned char dcf77_decode(const dcf_frame_t *frame, dcf_time_t *time)
+{
+	uint32_t lo = frame->bits;
+	uint32_t tm = frame->bits >> 16;
+	uint32_t dt = frame->bits >> 32;
+	dcf_time_t t;
+
+	// fixed bits
+	if((lo & (1UL << DCF_B_ZERO)) || !(lo & (1UL << DCF_B_START_OF_TIME)))
+		return 0;
+
+	// even parity over minute + P1 (21..28), hour + P2 (29..35)
+	// and date + P3 (36..58)
+	if(parity(FIELD(tm, 5, 8)) || parity(FIELD(tm, 13, 7)) || parity(FIELD(dt, 4, 23)))
+		return 0;
+
+	t.flags   = FIELD(lo, DCF_B_FLAGS, 6);
+	t.minute  = bcd(FIELD(tm, 5, 7));
+	t.hour    = bcd(FIELD(tm, 13, 6));
+	t.day     = bcd(FIELD(dt, 4, 6));
+	t.weekday = FIELD(dt, 10, 3);
+	t.month   = bcd(FIELD(dt, 13, 5));
+	t.year    = bcd(FIELD(dt, 18, 8));
+
+	// exactly one of CEST/CET is set
+	if(!(t.flags & (1 << DCF_F_CEST)) == !(t.flags & (1 << DCF_F_CET)))
+		return 0;
+
+	if(t.minute > 59 || t.hour > 23 || t.day < 1 || t.day > 31 ||
+	   t.weekday < 1 || t.month < 1 || t.month > 12 || t.year > 99)
+		return 0;
+
+	*time = t;
+	return 1;
 }
@@ -3,21 +3,15 @@
  *
  * About this program:
  * This is a decoder of the German 77.5KHz time code "DCF77".
- * The decoder is quite flexible in its design and can quite easy be
- * modified for your own purposes. It is built basically by one state
- * machine and a simple command parser, the state machine handles the
- * timing of the pulse width moduleated bits including the sync bit.
- * Then the command parser decodes the bits into a meaningful data
- * structure, each command has information on how many bits to decode
- * and if parity shall be counted and most important, how it shall be
- * decoded. If you only want part of the timecode then you can change
- * the struct and some of the decoding commands to ignore commands to
- * be able to get smaller memory footprint. This program was intended
- * to run on an AVR MCU but could easily be fitted for any MCU.
- * The decoder is intended to be polled at the frequency defined in
- * the dcf77.h file but you can quite easily change it to be interrupt
- * driven if you have a hardware timer that can replace the
- * "period_timer"-variable.
+ * It is split in two parts. A state machine, run on every edge of the
+ * receiver output, handles the timing of the pulse width modulated bits
+ * including the sync gap and shifts the bits into a 64-bit frame. At
+ * the minute mark the complete frame is handed over to dcf77_decode(),
+ * which runs outside of interrupt context once a minute and checks and
+ * extracts all fields of the frame at once using word-wide operations.
+ *
+ * (Minixie: the original command list interpreter has been replaced
+ * with the frame register and the word-wide decoder.)
  *                 
  * For more info:                                          
  * see www.rickard.gunee.com/projects            
@@ -39,7 +33,13 @@
  */
  
 
-// frequency in which the the dcf handler is polled
+#ifndef _DCF77_H_
+#define _DCF77_H_
+
+#include <inttypes.h>
+#include "rtc.h"
+
+// frequency of the time base used to measure pulses (rtc_ticks())
 #define DCF_HANDLER_FREQ	256
 
 
@@ -51,6 +51,40 @@
 // your signal is inverted
 #define dcf_pin (DCF_PORT & (1<<DCF_BIT))
 
+// edge interrupt control (INT0, any edge)
+#define DCF_IRQ_ON()			do { GIFR = _BV(INTF0); GICR |= _BV(INT0); } while (0)
+#define DCF_IRQ_OFF()			(GICR &= ~_BV(INT0))
+
+// input filter: pulses shorter than that are dropped as glitches
+#ifndef DCF_GLITCH_MIN
+#define DCF_GLITCH_MIN			(DCF_HANDLER_FREQ/32)
+#endif
+
+// more edges per second than that mask the edge interrupt and switch
+// over to polling, which lasts until the input has been quiet for
+// DCF_STORM_HOLD seconds
+#ifndef DCF_EDGE_LIMIT
+#define DCF_EDGE_LIMIT			16
+#endif
+
+#ifndef DCF_STORM_HOLD
+#define DCF_STORM_HOLD			4
+#endif
+
+// number of dcf77_poll() calls per sample, i.e. the caller's rate
+// divided by DCF_HANDLER_FREQ (the Minixie mux IRQ runs at 31.25kHz, or
+// once a slot at 244Hz with MUX_HWPWM, which is close enough)
+#ifndef DCF_POLL_DIV
+#if MUX_HWPWM == 1
+#define DCF_POLL_DIV			1
+#else
+#define DCF_POLL_DIV			122
+#endif
+#endif
+
+// number of equal samples needed to change the polled level
+#define DCF_POLL_SAMPLES		4
+
 // timing constants based on the handler update frequency
 // you probably don't need to change these unless you have
 // some kind of LP-filter on the input or somehting similar
@@ -68,28 +102,20 @@
 #define DCF_S_DATA_L			0x02
 #define DCF_S_DATA_H			0x03
 
-// dcf data order listing format
-#define DCF_CMD_MASK			0x70
-#define DCF_COUNTER_MASK		0x0F
-#define DCF_PARITY_COUNT		0x80
-
-// all commands with msb set to 1 will store data
-#define DCF_CMD_STORE_BIT		0x40
-
-// dcf data order listing commands
-#define DCF_CMD_END				0x00
-#define DCF_CMD_IGNORE			0x10
-#define DCF_CMD_PCHECK			0x20
-#define DCF_CMD_ZERO			0x30
-#define DCF_CMD_BCD				0x50
-#define DCF_CMD_BIN				0x60
-
-// dcf flags
-#define DCF_F_ABNORMAL_OPERATION 0x05
-#define DCF_F_DST_ANNOUNCEMENT   0x04
-#define DCF_F_CEST               0x03
-#define DCF_F_CET                0x02
-#define DCF_F_LEAP_SECOND        0x01
+// frame length, a minute with a leap second has one bit more
+#define DCF_FRAME_BITS			59
+
+// dcf handler events
+#define DCF_EV_MARK				0x01 // minute mark, see dcf_mark
+#define DCF_EV_FRAME			0x02 // a complete frame ended at this mark, see dcf_frame
+
+// dcf flags (bit numbers in dcf_time_t.flags, frame bits 15..20)
+#define DCF_F_ABNORMAL_OPERATION 0x00
+#define DCF_F_DST_ANNOUNCEMENT   0x01
+#define DCF_F_CEST               0x02
+#define DCF_F_CET                0x03
+#define DCF_F_LEAP_SECOND        0x04
+#define DCF_F_START_OF_TIME      0x05
 
 typedef struct
 {
@@ -102,7 +128,31 @@ typedef struct
 	unsigned char	year;
 } dcf_time_t;
 
+// received bits, bit n of the frame is the n-th second of the minute
+typedef union
+{
+	uint64_t		bits;
+	uint8_t			bytes[8];
+} dcf_frame_t;
+
+typedef struct
+{
+	unsigned short	edges;		// edge interrupts
+	unsigned short	glitches;	// pulses dropped by the glitch filter
+	unsigned short	storms;		// switches over to polling
+} dcf_stats_t;
+
 extern unsigned char dcf_state;
+extern dcf_stats_t dcf_stats;
+extern volatile unsigned char dcf_polled;
 extern dcf_time_t dcf_time;
+extern dcf_frame_t dcf_frame;
+extern rtc_stamp_t dcf_mark;
+
+void dcf77_enable(unsigned char on);
+unsigned char dcf77_edge(void);
+unsigned char dcf77_poll(void);
+void dcf77_second(void);
+unsigned char dcf77_decode(const dcf_frame_t *frame, dcf_time_t *time);
 
-unsigned int dcf77_handler(void);
+#endif
@@ -0,0 +1,167 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <avr/io.h>
+#include "minixie.h"
+#include "dcfsched.h"
+
+dcfsched_t dcfsched;
+
+static dcf_time_t last;
+
+static uint32_t now(void)
+{
+	rtc_stamp_t stamp;
+
+	rtc_snapshot(&stamp, NULL);
+	return stamp.seconds;
+}
+
+static void window_open(void)
+{
+	dcfsched.open = 1;
+	dcfsched.good = 0;
+	dcfsched.window = 0;
+	dcfsched.windows++;
+
+	DCF_PWR_PORT |= _BV(DCF_PWR_PIN);
+	dcf77_enable(1);
+
+	log_info("DCF window open, error %ums", dcfsched_error());
+}
+
+static void window_close(uint8_t success)
+{
+	uint32_t t = now();
+
+	dcf77_enable(0);
+	DCF_PWR_PORT &= ~_BV(DCF_PWR_PIN);
+
+	dcfsched.open = 0;
+	dcfsched.on_time += dcfsched.window;
+
+	if (success) {
+		dcfsched.synced = 1;
+		dcfsched.failures = 0;
+		dcfsched.last_sync = t;
+		dcfsched.retry = t;
+	} else {
+		uint32_t backoff = DCF_SCHED_RETRY << dcfsched.failures;
+
+		if (backoff < DCF_SCHED_RETRY_MAX)
+			dcfsched.failures++;
+		else
+			backoff = DCF_SCHED_RETRY_MAX;
+		dcfsched.retry = t + backoff;
+	}
+
+	log_info("DCF window closed after %us, %S", dcfsched.window,
+			 success ? PSTR("synced") : PSTR("failed"));
+}
+
+/**
+ * @brief Check if two frames are a minute apart.
+ *
+ * The date is only compared within the hour, which is enough to catch
+ * a frame that passed parity by chance.
+ */
+static uint8_t consecutive(const dcf_time_t *prev, const dcf_time_t *t)
+{
+	uint8_t mm = prev->minute + 1;
+	uint8_t hh = prev->hour;
+
+	if (mm == 60) {
+		mm = 0;
+		hh = (hh + 1) % 24;
+		if (hh != t->hour)
+			return 0;
+		return t->minute == 0;
+	}
+
+	return t->minute == mm && t->hour == hh && t->day == prev->day &&
+		   t->month == prev->month && t->year == prev->year;
+}
+
+/**
+ * @brief Estimated error of the clock since the last good sync, in ms.
+ */
+uint16_t dcfsched_error(void)
+{
+	uint32_t err;
+
+	if (!dcfsched.synced)
+		return UINT16_MAX;
+
+	err = (now() - dcfsched.last_sync) / 1000;
+	err *= rtc_drift.estimates ? DCF_SCHED_PPM_TRIM : DCF_SCHED_PPM_RAW;
+
+	return err < UINT16_MAX ? err : UINT16_MAX;
+}
+
+/**
+ * @brief Set up the receiver supply pin and open the first window.
+ */
+void dcfsched_init(void)
+{
+	DCF_PWR_DDR |= _BV(DCF_PWR_PIN);
+	window_open();
+}
+
+/**
+ * @brief Open and close windows, call once a second from the main loop.
+ */
+void dcfsched_second(void)
+{
+	clock_t t;
+
+	if (dcfsched.open) {
+		if (++dcfsched.window >= DCF_SCHED_WINDOW)
+			window_close(0);
+		return;
+	}
+
+	if ((int32_t)(now() - dcfsched.retry) < 0)
+		return;
+
+	rtc_get_time(&t);
+	if (!dcfsched.synced || dcfsched_error() > DCF_SCHED_MAX_ERR ||
+		(t.hh == DCF_SCHED_HOUR && t.mm == 0 && dcfsched_error() > 0)) {
+		window_open();
+	}
+}
+
+/**
+ * @brief Report a valid frame, closes the window once enough agree.
+ */
+void dcfsched_frame(const dcf_time_t *time)
+{
+	if (!dcfsched.open)
+		return;
+
+	if (dcfsched.good && consecutive(&last, time))
+		dcfsched.good++;
+	else
+		dcfsched.good = 1;
+	last = *time;
+
+	if (dcfsched.good >= DCF_SCHED_FRAMES)
+		window_close(1);
+}
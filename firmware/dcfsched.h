@@ -0,0 +1,104 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _DCFSCHED_H_
+#define _DCFSCHED_H_
+
+#include <inttypes.h>
+#include "dcf77.h"
+
+/**
+ * The DCF77 receiver draws more than the rest of the clock in backup
+ * mode, and once the crystal trim has converged it only needs to run a
+ * few minutes a day. The scheduler powers the receiver in sync windows:
+ * - right after power-up, until the first good sync,
+ * - every night at DCF_SCHED_HOUR, when reception is best,
+ * - whenever the estimated error since the last sync exceeds
+ *   DCF_SCHED_MAX_ERR, which is what keeps an untrimmed clock in step.
+ *
+ * A window closes as soon as DCF_SCHED_FRAMES consecutive frames agree
+ * with each other, or after DCF_SCHED_WINDOW seconds without that.
+ * Failed windows back off exponentially from DCF_SCHED_RETRY up to
+ * DCF_SCHED_RETRY_MAX. The INT0 input is masked while the receiver is
+ * off, so a floating output can't wake the CPU.
+ *
+ * The receiver supply is switched by DCF_PWR_PIN (PB0 by default, which
+ * is not routed to the aux connector and needs a wire to the receiver's
+ * power-up input; RTC_PPS=1 builds use it too, see rtc.h). Build with
+ * DCF_SCHED=1 to enable the scheduler.
+ */
+
+#ifndef DCF_PWR_DDR
+#define DCF_PWR_DDR         DDRB
+#define DCF_PWR_PORT        PORTB
+#define DCF_PWR_PIN         PB0
+#endif
+
+#ifndef DCF_SCHED_HOUR
+#define DCF_SCHED_HOUR      3               // local hour of the nightly window
+#endif
+
+#ifndef DCF_SCHED_WINDOW
+#define DCF_SCHED_WINDOW    900             // in s
+#endif
+
+#ifndef DCF_SCHED_FRAMES
+#define DCF_SCHED_FRAMES    3               // consistent frames to close a window
+#endif
+
+#ifndef DCF_SCHED_RETRY
+#define DCF_SCHED_RETRY     900UL           // in s
+#endif
+
+#ifndef DCF_SCHED_RETRY_MAX
+#define DCF_SCHED_RETRY_MAX 28800UL         // in s
+#endif
+
+#ifndef DCF_SCHED_MAX_ERR
+#define DCF_SCHED_MAX_ERR   250             // in ms
+#endif
+
+// assumed residual drift before and after the trim has been estimated
+#define DCF_SCHED_PPM_RAW   30
+#define DCF_SCHED_PPM_TRIM  2
+
+/**
+ * @brief Scheduler state, read-only outside of dcfsched.c
+ */
+typedef struct {
+	uint8_t open;       /**< set while the receiver is powered */
+	uint8_t good;       /**< consistent frames in the current window */
+	uint8_t failures;   /**< failed windows in a row */
+	uint8_t synced;     /**< set once a window succeeded */
+	uint16_t window;    /**< seconds since the window opened */
+	uint16_t windows;   /**< windows opened since power-up */
+	uint32_t on_time;   /**< total receiver on time, in s */
+	uint32_t last_sync; /**< end of the last good window, in rtc seconds */
+	uint32_t retry;     /**< no window opens before that, in rtc seconds */
+} dcfsched_t;
+
+extern dcfsched_t dcfsched;
+
+void dcfsched_init(void);
+void dcfsched_second(void);
+void dcfsched_frame(const dcf_time_t *time);
+uint16_t dcfsched_error(void);
+
+#endif
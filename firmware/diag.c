@@ -0,0 +1,95 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include "minixie.h"
+#include "diag.h"
+
+diag_t diag __attribute__((section(".noinit")));
+
+// the record as it was at the last reset
+static diag_t last;
+
+/**
+ * Runs before .data and .bss are set up: grab the reset flags and clear
+ * them, so the next reset reports its own cause only. On the ATmega88
+ * and up the watchdog stays on after a watchdog reset, with its old
+ * prescaler; it is turned off once WDRF is clear.
+ */
+static void diag_early(void) __attribute__((naked, used, section(".init3")));
+static void diag_early(void)
+{
+	diag.mcucsr = MCUCSR;
+	MCUCSR = 0;
+#if MCU_MX8 == 1
+	wdt_disable();
+#endif
+}
+
+/**
+ * @brief Take over the record left by the last reset and start a new one.
+ */
+void diag_init(void)
+{
+	if ((diag.mcucsr & _BV(PORF)) || diag.magic != DIAG_MAGIC) {
+		uint8_t mcucsr = diag.mcucsr;
+
+		diag = (diag_t){0};
+		diag.magic = DIAG_MAGIC;
+		diag.mcucsr = mcucsr;
+	} else {
+		diag.resets++;
+		if (diag.mcucsr & _BV(WDRF))
+			diag.wdt_resets++;
+	}
+
+	last = diag;
+	diag.checkpoint = DIAG_CP_BOOT;
+	diag.event = DIAG_EV_NONE;
+}
+
+/**
+ * @brief Log the cause of and the state at the last reset.
+ */
+void diag_report(void)
+{
+	log_info("Reset:%S%S%S%S, resets %u, wdt %u",
+			 (last.mcucsr & _BV(PORF)) ? PSTR(" power-on") : PSTR(""),
+			 (last.mcucsr & _BV(EXTRF)) ? PSTR(" external") : PSTR(""),
+			 (last.mcucsr & _BV(BORF)) ? PSTR(" brown-out") : PSTR(""),
+			 (last.mcucsr & _BV(WDRF)) ? PSTR(" watchdog") : PSTR(""),
+			 diag.resets, diag.wdt_resets);
+	if (!(last.mcucsr & _BV(PORF)))
+		log_info("At checkpoint %u, event %u, pc 0x%04x",
+				 last.checkpoint, last.event, last.pc << 1);
+}
+
+/**
+ * @brief Reset through the watchdog.
+ */
+void diag_reset(void)
+{
+	DIAG_CHECKPOINT(DIAG_CP_RESET);
+	wdt_enable(WDTO_15MS);
+	while (1)
+		;
+}
@@ -0,0 +1,127 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _DIAG_H_
+#define _DIAG_H_
+
+#include <inttypes.h>
+#include "trace.h"
+
+/**
+ * The diagnostic record lives in .noinit RAM, so it survives every reset
+ * but a power-on one. It tells what the firmware was doing when the last
+ * reset hit:
+ * - the reset cause, taken from MCUCSR in .init3,
+ * - the last main loop checkpoint and the last event,
+ * - the PC interrupted by the last RTC tick. The ATmega8 watchdog can't
+ *   raise an IRQ, but the RTC ticks at least once during the 2s watchdog
+ *   timeout, so after a hang with IRQs enabled the PC points into the
+ *   code which hung.
+ *
+ * Look the PC up with avr-addr2line (multiply it by 2, it is a word
+ * address) or in the .lss listing.
+ */
+
+// sample the PC from the RTC IRQ
+#ifndef DIAG_PC
+#define DIAG_PC         1
+#endif
+
+#define DIAG_MAGIC      0xD1A6
+
+/**
+ * @brief Main loop checkpoints
+ */
+typedef enum {
+	DIAG_CP_BOOT = 0,
+	DIAG_CP_SLEEP,
+	DIAG_CP_REFRESH,
+	DIAG_CP_COMMAND,
+	DIAG_CP_TLM,
+	DIAG_CP_BEEP,
+	DIAG_CP_BUTTONS,
+	DIAG_CP_DCF,
+	DIAG_CP_FRAME,
+	DIAG_CP_RESUME,
+	DIAG_CP_BACKUP,
+	DIAG_CP_RESET,
+} diag_cp_t;
+
+/**
+ * @brief Events
+ */
+typedef enum {
+	DIAG_EV_NONE = 0,
+	DIAG_EV_PWR_FAIL,
+	DIAG_EV_PWR_BACK,
+	DIAG_EV_DCF_SYNC,
+	DIAG_EV_RTC_TRIM,
+	DIAG_EV_HV_TRIP,
+} diag_ev_t;
+
+/**
+ * @brief Diagnostic record
+ */
+typedef struct {
+	uint16_t magic;
+	uint8_t mcucsr;     /**< reset flags of the last reset */
+	uint8_t checkpoint; /**< last main loop checkpoint, see diag_cp_t */
+	uint8_t event;      /**< last event, see diag_ev_t */
+	uint16_t pc;        /**< PC interrupted by the last RTC tick (word address) */
+	uint16_t resets;    /**< resets since power-up */
+	uint16_t wdt_resets;
+} diag_t;
+
+extern diag_t diag;
+
+// both go to the trace as well, see trace.h
+#define DIAG_CHECKPOINT(cp)  (diag.checkpoint = (cp), TRACE_EVENT(TRACE_TASK, (cp)))
+#define DIAG_EVENT(ev)       (diag.event = (ev), TRACE_EVENT(TRACE_DIAG_EV, (ev)))
+
+/**
+ * @brief Save the interrupted PC to a uint16_t at addr
+ *
+ * For use at the top of a naked ISR, right after the return address was
+ * pushed: it is found above the three registers saved here. Leaves all
+ * registers and SREG intact.
+ */
+#define DIAG_SAMPLE_PC_TO(addr) asm volatile ( \
+		"push r24"          "\n\t"       \
+		"push r30"          "\n\t"       \
+		"push r31"          "\n\t"       \
+		"in r30, __SP_L__"  "\n\t"       \
+		"in r31, __SP_H__"  "\n\t"       \
+		"ldd r24, Z+4"      "\n\t"       \
+		"sts %0+1, r24"     "\n\t"       \
+		"ldd r24, Z+5"      "\n\t"       \
+		"sts %0, r24"       "\n\t"       \
+		"pop r31"           "\n\t"       \
+		"pop r30"           "\n\t"       \
+		"pop r24"           "\n\t"       \
+		:: "i" (addr))
+
+// the PC of the last RTC tick, see diag_t
+#define DIAG_SAMPLE_PC()     DIAG_SAMPLE_PC_TO(&diag.pc)
+
+void diag_init(void);
+void diag_report(void);
+void diag_reset(void) __attribute__((noreturn));
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <avr/interrupt.h>
+#include <util/crc16.h>
+#include "uart.h"
+#include "frame.h"
+
+enum {
+	RX_IDLE,
+	RX_TYPE,
+	RX_LEN,
+	RX_PAYLOAD,
+	RX_CRC_LO,
+	RX_CRC_HI,
+};
+
+static struct {
+	uint8_t state;
+	uint8_t n;
+	uint8_t crc_lo;
+	uint16_t crc;
+	frame_rx_t cur;
+	frame_rx_t frame;   // last good frame, until frame_read()
+	volatile uint8_t ready;
+} rx;
+
+volatile uint16_t frame_rx_errors;
+
+/**
+ * @brief Write a binary frame to the console UART.
+ *
+ * The frame is queued only if it fits in the TX queue as a whole, so
+ * a busy line never leaves a truncated frame in the stream.
+ *
+ * @param[in] type frame type
+ * @param[in] payload pointer to the payload
+ * @param[in] len payload length (up to FRAME_MAX_LEN bytes)
+ * @return 1 if the frame was queued, 0 if it was dropped
+ */
+uint8_t frame_write(uint8_t type, const void *payload, uint8_t len)
+{
+	uint8_t buffer[FRAME_MAX_LEN + FRAME_OVERHEAD];
+	const uint8_t *bp = payload;
+	uint16_t crc = 0xFFFF;
+	uint8_t n = 0;
+
+	if (len > FRAME_MAX_LEN || uart_tx_free(FRAME_UART) < len + FRAME_OVERHEAD)
+		return 0;
+
+	buffer[n++] = FRAME_SOF;
+	buffer[n++] = type;
+	buffer[n++] = len;
+	for (uint8_t i = 0; i < len; i++)
+		buffer[n++] = bp[i];
+
+	for (uint8_t i = 1; i < n; i++)
+		crc = _crc_ccitt_update(crc, buffer[i]);
+
+	buffer[n++] = crc & 0xFF;
+	buffer[n++] = crc >> 8;
+
+	return uart_write(FRAME_UART, buffer, n) == n;
+}
+
+/**
+ * @brief Feed a received byte to the frame parser.
+ *
+ * Meant as the UART RX filter, i.e. it runs in IRQ context. A good frame
+ * is kept until frame_read(); frames arriving before that are dropped.
+ *
+ * @param[in] c received byte
+ * @return 1 if the byte belongs to a frame, 0 if it is text
+ */
+uint8_t frame_rx(uint8_t c)
+{
+	switch (rx.state) {
+		case RX_IDLE:
+			if (c != FRAME_SOF)
+				return 0;
+			rtc_snapshot(&rx.cur.stamp, NULL);
+			rx.crc = 0xFFFF;
+			rx.state = RX_TYPE;
+			return 1;
+
+		case RX_TYPE:
+			rx.cur.type = c;
+			rx.state = RX_LEN;
+			break;
+
+		case RX_LEN:
+			if (c > FRAME_MAX_LEN) {
+				frame_rx_errors++;
+				rx.state = RX_IDLE;
+				return 1;
+			}
+			rx.cur.len = c;
+			rx.n = 0;
+			rx.state = c ? RX_PAYLOAD : RX_CRC_LO;
+			break;
+
+		case RX_PAYLOAD:
+			if (rx.n < FRAME_RX_MAX)
+				rx.cur.payload[rx.n] = c;
+			if (++rx.n == rx.cur.len)
+				rx.state = RX_CRC_LO;
+			break;
+
+		case RX_CRC_LO:
+			rx.crc_lo = c;
+			rx.state = RX_CRC_HI;
+			return 1;
+
+		case RX_CRC_HI:
+			rx.state = RX_IDLE;
+			if (rx.crc != (rx.crc_lo | (uint16_t)c << 8))
+				frame_rx_errors++;
+			else if (rx.cur.len <= FRAME_RX_MAX && !rx.ready) {
+				rx.frame = rx.cur;
+				rx.ready = 1;
+			}
+			return 1;
+	}
+
+	rx.crc = _crc_ccitt_update(rx.crc, c);
+	return 1;
+}
+
+/**
+ * @brief Get the last received frame.
+ *
+ * @param[out] frame the frame
+ * @return 1 if there was one, 0 otherwise
+ */
+uint8_t frame_read(frame_rx_t *frame)
+{
+	uint8_t ready;
+
+	cli();
+	ready = rx.ready;
+	if (ready) {
+		*frame = rx.frame;
+		rx.ready = 0;
+	}
+	sei();
+
+	return ready;
+}
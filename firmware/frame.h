@@ -0,0 +1,84 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <inttypes.h>
+#include "rtc.h"
+
+/**
+ * Binary frames share the console UART with the text log. Every frame
+ * starts with a byte which never appears in the log output so a host
+ * tool can pick frames out of the stream:
+ *
+ *   SOF | type | len | payload[len] | crc16 (LSB first)
+ *
+ * The CRC is avr-libc's _crc_ccitt_update() (init 0xFFFF) computed over
+ * type, len and payload. Multi-byte payload fields are little-endian.
+ *
+ * Received frames are picked out of the RX stream by frame_rx(), which
+ * runs from the UART IRQ as its byte filter: frame bytes never reach the
+ * command parser, and the arrival of the SOF is time stamped. Frames
+ * longer than FRAME_RX_MAX are checked but dropped.
+ */
+
+#ifndef FRAME_UART
+#define FRAME_UART      UART0
+#endif
+
+#define FRAME_SOF       0xA5
+#define FRAME_OVERHEAD  5
+#define FRAME_MAX_LEN   32
+
+#ifndef FRAME_RX_MAX
+#define FRAME_RX_MAX    8
+#endif
+
+/**
+ * @brief Frame types
+ */
+typedef enum {
+	FRAME_TLM = 0x01, /**< telemetry sample, see tlm_sample_t */
+	FRAME_TIME = 0x02, /**< chain time, see chain_time_t */
+	FRAME_SYNC_REQ = 0x03, /**< host sync request, see hsync_req_t */
+	FRAME_SYNC_REPLY = 0x04, /**< host sync reply, see hsync_reply_t */
+	FRAME_SYNC_ADJ = 0x05, /**< host sync offset, see hsync_adj_t */
+	FRAME_TRACE = 0x06, /**< trace dump, see trace_hdr_t */
+	FRAME_PROF = 0x07, /**< profile dump, see prof_hdr_t */
+} frame_type_t;
+
+/**
+ * @brief Received frame
+ */
+typedef struct {
+	uint8_t type;
+	uint8_t len;
+	uint8_t payload[FRAME_RX_MAX];
+	rtc_stamp_t stamp;  /**< time the SOF was received */
+} frame_rx_t;
+
+extern volatile uint16_t frame_rx_errors;
+
+uint8_t frame_write(uint8_t type, const void *payload, uint8_t len);
+uint8_t frame_rx(uint8_t c);
+uint8_t frame_read(frame_rx_t *frame);
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _GPIO_H_
+#define _GPIO_H_
+
+#include <avr/io.h>
+
+/**
+ * Pins are defined as a port letter and a bit number, e.g.
+ *
+ *   #define PIN_BUZZER B, 2
+ *
+ * and the macros below paste them into the port registers at compile
+ * time. Pin operations then compile to a single sbi/cbi (or sbic/sbis
+ * for reads) on a fixed I/O address, which is also atomic, so main and
+ * IRQ code can share a port without masking IRQs.
+ *
+ * GPIO_TOGGLE and group writes (GPIO_WRITE_GROUP) are a read-modify-write of the whole
+ * port and are not atomic: all writers of the other bits of that port
+ * must either run in IRQ context or use the single pin macros.
+ */
+
+#define GPIO_HIGH(pin)              _GPIO_HIGH(pin)
+#define GPIO_LOW(pin)               _GPIO_LOW(pin)
+#define GPIO_TOGGLE(pin)            _GPIO_TOGGLE(pin)
+#define GPIO_READ(pin)              _GPIO_READ(pin)
+#define GPIO_OUTPUT(pin)            _GPIO_OUTPUT(pin)
+#define GPIO_INPUT(pin)             _GPIO_INPUT(pin)
+#define GPIO_BIT(pin)               _GPIO_BIT(pin)
+
+// write value to the mask bits of port, e.g. GPIO_WRITE_GROUP(C, 0x0F, v)
+#define GPIO_WRITE_GROUP(port, mask, value) _GPIO_WRITE_GROUP(port, mask, value)
+
+#define _GPIO_HIGH(port, bit)       (PORT##port |= _BV(bit))
+#define _GPIO_LOW(port, bit)        (PORT##port &= ~_BV(bit))
+#define _GPIO_TOGGLE(port, bit)     (PORT##port ^= _BV(bit))
+#define _GPIO_READ(port, bit)       (PIN##port & _BV(bit))
+#define _GPIO_OUTPUT(port, bit)     (DDR##port |= _BV(bit))
+#define _GPIO_INPUT(port, bit)      (DDR##port &= ~_BV(bit))
+#define _GPIO_BIT(port, bit)        _BV(bit)
+#define _GPIO_WRITE_GROUP(port, mask, value) \
+	(PORT##port = (PORT##port & ~(mask)) | ((value) & (mask)))
+
+#endif
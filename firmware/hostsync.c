@@ -0,0 +1,103 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <string.h>
+#include "minixie.h"
+#include "uart.h"
+#include "frame.h"
+#include "hostsync.h"
+
+#define SECONDS_PER_DAY     86400L
+
+hsync_t hsync;
+
+/**
+ * Wall clock time of a stamp in ticks since midnight.
+ */
+static uint32_t day_ticks(const rtc_stamp_t *stamp)
+{
+	rtc_stamp_t now;
+	clock_t t;
+	int32_t sod;
+
+	rtc_snapshot(&now, &t);
+	sod = t.hh * 3600L + t.mm * 60 + t.ss - (int32_t)(now.seconds - stamp->seconds);
+	if (sod < 0)
+		sod += SECONDS_PER_DAY;
+
+	return sod * RTC_TICKS_PER_SEC + stamp->subticks;
+}
+
+/**
+ * Answer a sync request.
+ */
+static void reply(const frame_rx_t *frame)
+{
+	hsync_req_t req;
+	hsync_reply_t r;
+	rtc_stamp_t now;
+
+	if (!uart_tx_idle(FRAME_UART)) {
+		hsync.busy++;
+		return;
+	}
+
+	memcpy(&req, frame->payload, sizeof(req));
+	r.seq = req.seq;
+	r.rx = day_ticks(&frame->stamp);
+	rtc_snapshot(&now, NULL);
+	r.tx = day_ticks(&now);
+
+	if (frame_write(FRAME_SYNC_REPLY, &r, sizeof(r)))
+		hsync.requests++;
+	else
+		hsync.busy++;
+}
+
+/**
+ * @brief Handle a sync frame from the host.
+ *
+ * @param[in] frame received frame
+ * @return 1 if the RTC trim has been updated, 0 otherwise
+ */
+uint8_t hsync_frame(const frame_rx_t *frame)
+{
+	hsync_adj_t adj;
+
+	if (frame->type == FRAME_SYNC_REQ && frame->len == sizeof(hsync_req_t)) {
+		reply(frame);
+		return 0;
+	}
+
+	if (frame->type != FRAME_SYNC_ADJ || frame->len != sizeof(adj))
+		return 0;
+
+	memcpy(&adj, frame->payload, sizeof(adj));
+
+	// round to the nearest tick
+	if (adj.offset >= 0)
+		hsync.offset = (adj.offset + 128) / 256;
+	else
+		hsync.offset = (adj.offset - 128) / 256;
+	hsync.adjusts++;
+
+	return rtc_correct(&frame->stamp, hsync.offset, 1);
+}
@@ -0,0 +1,80 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _HOSTSYNC_H_
+#define _HOSTSYNC_H_
+
+#include <inttypes.h>
+#include "rtc.h"
+#include "frame.h"
+
+/**
+ * NTP style time sync with a host over the console UART. The host sends
+ * FRAME_SYNC_REQ, the clock answers with FRAME_SYNC_REPLY carrying the
+ * time the request's SOF arrived (t2) and the time the reply was sent
+ * (t3), both in ticks since midnight. From its own send and receive
+ * times (t1, t4) the host gets the offset and the round trip delay; it
+ * filters them and sends the offset back in FRAME_SYNC_ADJ. The clock
+ * slews offsets up to RTC_SLEW_MAX ticks and steps larger ones, and the
+ * offsets feed the drift estimation like the DCF77 syncs do.
+ *
+ * The reply is only sent when TX is idle, so it goes out right after t3
+ * was taken. The stamps are 1/256s; the host averages the quantization
+ * out over several exchanges. See tools/minixie_timed.py.
+ */
+
+/**
+ * @brief FRAME_SYNC_REQ payload
+ */
+typedef struct {
+	uint16_t seq;
+} __attribute__((packed)) hsync_req_t;
+
+/**
+ * @brief FRAME_SYNC_REPLY payload
+ */
+typedef struct {
+	uint16_t seq;       /**< seq of the request */
+	uint32_t rx;        /**< request SOF received, in ticks since midnight */
+	uint32_t tx;        /**< reply sent, in ticks since midnight */
+} __attribute__((packed)) hsync_reply_t;
+
+/**
+ * @brief FRAME_SYNC_ADJ payload
+ */
+typedef struct {
+	int32_t offset;     /**< clock minus host time in 1/65536s */
+} __attribute__((packed)) hsync_adj_t;
+
+/**
+ * @brief Host sync counters
+ */
+typedef struct {
+	uint16_t requests;  /**< requests answered */
+	uint16_t busy;      /**< requests not answered because TX was busy */
+	uint16_t adjusts;   /**< offsets applied */
+	int32_t offset;     /**< last offset in ticks */
+} hsync_t;
+
+extern hsync_t hsync;
+
+uint8_t hsync_frame(const frame_rx_t *frame);
+
+#endif
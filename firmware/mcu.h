@@ -0,0 +1,110 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _MCU_H_
+#define _MCU_H_
+
+#include <avr/io.h>
+
+/**
+ * The board takes an ATmega8 or one of the pin compatible ATmega88PA,
+ * ATmega168PA and ATmega328P (-mmcu=atmega88pa etc.). The modules are
+ * shared: registers which were only renamed keep their ATmega8 names and
+ * are mapped to the new ones below; where one ATmega8 register was split,
+ * the modules use the new names (TIMSK0, TIMSK2, EICRA, SMCR, ...) and
+ * those are mapped back on the ATmega8.
+ *
+ * The newer parts add compare units to Timer0, which time the mux PWM
+ * (MUX_HWPWM), and pin change IRQs, which wake the tubes on either
+ * button. The ATmega328P has 2K of SRAM, MCU_BIG_RAM sizes the UART
+ * queues, the trace and the profile up for it.
+ */
+
+#if defined(__AVR_ATmega88__) || defined(__AVR_ATmega88A__) || defined(__AVR_ATmega88P__) || \
+	defined(__AVR_ATmega88PA__) || defined(__AVR_ATmega168__) || defined(__AVR_ATmega168A__) || \
+	defined(__AVR_ATmega168P__) || defined(__AVR_ATmega168PA__) || defined(__AVR_ATmega328__) || \
+	defined(__AVR_ATmega328P__)
+#define MCU_MX8         1
+#else
+#define MCU_MX8         0
+#endif
+
+#define MCU_BIG_RAM     (RAMEND >= 0x8FF)
+
+// time the anode PWM with the Timer0 compare units, see digit_mux()
+#ifndef MUX_HWPWM
+#define MUX_HWPWM       MCU_MX8
+#endif
+
+#if MUX_HWPWM == 1 && MCU_MX8 == 0
+#error "MUX_HWPWM needs the Timer0 compare units of the ATmega88/168/328"
+#endif
+
+#if MCU_MX8 == 1
+// external IRQs and reset flags
+#define GICR            EIMSK
+#define GIFR            EIFR
+#define MCUCSR          MCUSR
+
+// Timer0 clock select, Timer2 (RTC) with compare unit A
+#define TCCR0           TCCR0B
+#define TCCR2           TCCR2B
+#define OCR2            OCR2A
+#define OCIE2           OCIE2A
+#define OCF2            OCF2A
+#define OCR2UB          OCR2AUB
+#define TCR2UB          TCR2BUB
+#define TIMER2_COMP_vect TIMER2_COMPA_vect
+
+// USART0
+#define USART_RXC_vect  USART_RX_vect
+#define UDR             UDR0
+#define UCSRA           UCSR0A
+#define UCSRB           UCSR0B
+#define UCSRC           UCSR0C
+#define UBRRL           UBRR0L
+#define UBRRH           UBRR0H
+#define RXC             RXC0
+#define TXC             TXC0
+#define U2X             U2X0
+#define MPCM            MPCM0
+#define DOR             DOR0
+#define FE              FE0
+#define PE              UPE0
+#define RXCIE           RXCIE0
+#define UDRIE           UDRIE0
+#define RXEN            RXEN0
+#define TXEN            TXEN0
+#define UCSZ0           UCSZ00
+#define UCSZ1           UCSZ01
+// UCSRC has its own address
+#define UART_URSEL      0
+#else
+#define TIMSK0          TIMSK
+#define TIMSK2          TIMSK
+#define TIFR0           TIFR
+#define TIFR2           TIFR
+#define EICRA           MCUCR
+#define SMCR            MCUCR
+// UCSRC shares its address with UBRRH
+#define UART_URSEL      _BV(URSEL)
+#endif
+
+#endif
@@ -18,45 +18,33 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  *
  */
+#include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <avr/wdt.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 #include "logger.h"
 #include "dcf77.h"
 #include "minixie.h"
+#include "rtc.h"
 #include "uart.h"
 #include "adc.h"
-
-uint16_t timer = 0;
-
-/* 
- * Anode mapping table:
- * HH -> PB5
- * HL -> PB4
- * MH -> PD5
- * ML -> PD6
- * DOT -> PB3
- */
-static const pad_t const anode_pad_map[] = {
-	PAD(&PORTB, 5),
-	PAD(&PORTB, 4),
-	PAD(&PORTD, 5),
-	PAD(&PORTD, 6),
-	PAD(&PORTB, 3),
-};
-
-static const pad_t const digit_pad_map[] = {
-	PAD(&PORTC, 0),
-	PAD(&PORTC, 2),
-	PAD(&PORTC, 3),
-	PAD(&PORTC, 1),
-};
-
-static const pad_t buzzer_pad = PAD(&PORTB, 2);
+#include "telemetry.h"
+#include "config.h"
+#include "dcfsched.h"
+#include "power.h"
+#include "diag.h"
+#include "frame.h"
+#include "chain.h"
+#include "hostsync.h"
+#include "trace.h"
+#include "bench.h"
+#include "prof.h"
 
 #if ADAPTIVE_DC == 1
 static const uint16_t const dc_light_map[][2] = {
@@ -67,10 +55,30 @@ static const uint16_t const dc_light_map[][2] = {
 };
 #endif
 
+#if ADAPTIVE_BRI == 1
+static const uint16_t const bri_light_map[][2] = {
+	{700,  24},
+	{800,  16},
+	{900,  8},
+	{1000, 3},
+};
+#endif
+
+// brightness level to lit ticks per mux slot, gamma 2.2
+static const uint8_t gamma_map[BRI_LEVELS] PROGMEM = {
+	0,   1,   1,   1,   1,   2,   3,   5,
+	6,   8,   11,  13,  16,  19,  22,  26,
+	30,  34,  38,  43,  48,  54,  60,  66,
+	72,  79,  86,  94,  102, 110, 118, 127,
+};
+
 typedef void (*pt)(void);
 
-// digit mapping table
-static const uint8_t const dt[] = {0,9,8,1,4,7,2,3,6,5};
+// digit to DIGIT_PORT pattern, the 74141 outputs are wired out of order
+static const uint8_t digit_map[] = {
+	DIGIT_BITS(0), DIGIT_BITS(9), DIGIT_BITS(8), DIGIT_BITS(1), DIGIT_BITS(4),
+	DIGIT_BITS(7), DIGIT_BITS(2), DIGIT_BITS(3), DIGIT_BITS(6), DIGIT_BITS(5),
+};
 
 /**
  * Module context - holds variables related to the module state.
@@ -85,21 +93,30 @@ typedef struct  {
 
 	int debug: 1;
 	int input: 1;
+	int tlm: 1;
 
-	int dcf_sync: 1;
+	int dcf_frame: 1;
 	int dcf_irq: 1;
 	int dcf_debug: 1;
 	int dcf_sync_cnt;
 
+	int night: 1;
+	int wake: 1;
+	uint16_t night_dark;
+	uint8_t night_hold;
+	uint16_t light_avg;
+
 	uint8_t duty_cycle;
 	uint8_t dot_pwm;
+	uint8_t brightness;
+	uint8_t ocr[5];
 
 	uint8_t digit[4];
 
 	uint16_t adc_hv;
 	uint16_t adc_light;
+	uint8_t adc_hv_seq;
 
-	clock_t time;
 	clock_t alarm;
 
 } ctx_t;
@@ -112,6 +129,8 @@ volatile static ctx_t ctx = {
 	.dcf_sync_cnt = 0,
 	.duty_cycle = SMPS_PWM_DC,
 	.dot_pwm = 0,
+	.brightness = BRI_MAX,
+	.ocr = {MUX_OCR_MAX, MUX_OCR_MAX, MUX_OCR_MAX, MUX_OCR_MAX, MUX_OCR_MAX},
 	.digit = {0},
 	.adc_hv = 0,
 	.adc_light = 0,
@@ -120,22 +139,57 @@ volatile static ctx_t ctx = {
 
 static void digit_mux(void);
 static void rtc_tick(void);
-static void dc_toggle(void);
+static void refresh(void);
+static void refresh_display(const clock_t *now);
+int adc_cb(int channel, uint16_t value, uint8_t tag);
 
 // External interrupt
 ISR(INT0_vect)
 {
-	if (dcf77_handler() > 0) {
-		ctx.dcf_sync_cnt++;
-		ctx.dcf_sync = 1;
+	uint8_t events;
+
+	TRACE_EVENT(TRACE_IRQ_IN, TRACE_V_INT0);
+	// a UART IRQ may delay the time stamp by a few us, which is
+	// well below its 1/256s resolution
+	IRQ_NEST_BEGIN(GICR, INT0);
+	events = dcf77_edge();
+	cli();
+	// unless dcf77_edge() switched over to polling
+	if (!dcf_polled)
+		GICR |= _BV(INT0);
+
+	if (events & DCF_EV_FRAME) {
+		ctx.dcf_frame = 1;
 	}
 	ctx.dcf_irq = 1;
+	TRACE_EVENT(TRACE_IRQ_OUT, TRACE_V_INT0);
+}
+
+// Buttons, enabled while the tubes sleep
+ISR(BTN_vect)
+{
+	TRACE_EVENT(TRACE_IRQ_IN, TRACE_V_INT1);
+	BTN_IRQ_OFF();
+	ctx.wake = 1;
+	TRACE_EVENT(TRACE_IRQ_OUT, TRACE_V_INT1);
 }
 
 // Mux timer
-ISR(TIMER0_OVF_vect)
+ISR(MUX_vect)
 {
+	// the pins are switched right away, the rest may be preempted
 	digit_mux();
+	TRACE_SLOT();
+	TRACE_EVENT(TRACE_MUX_IN, 0);
+	IRQ_NEST_BEGIN(TIMSK0, MUX_IE);
+	// the DCF77 input is sampled from here while its IRQ is masked
+	if (dcf_polled && (dcf77_poll() & DCF_EV_FRAME))
+		ctx.dcf_frame = 1;
+	if (tlm_tick())
+		ctx.tlm = 1;
+	IRQ_NEST_END(TIMSK0, MUX_IE);
+	// a pending IRQ means the next one is late
+	TRACE_EVENT(TRACE_MUX_OUT, (TIFR0 & _BV(MUX_IF)) != 0);
 }
 
 // SPMS PWM timer
@@ -143,37 +197,44 @@ ISR(TIMER0_OVF_vect)
 //{
 //}
 
-// RTC clock timer - IRQ invoked once a second
-ISR(TIMER2_OVF_vect)
-{
-	timer += 256;
-	rtc_tick();
-}
-
 // Analog comparator
 ISR(ANA_COMP_vect)
 {
-	dc_toggle();
+	TRACE_EVENT(TRACE_IRQ_IN, TRACE_V_ANA_COMP);
+	pwr_fail();
+	TRACE_EVENT(TRACE_IRQ_OUT, TRACE_V_ANA_COMP);
 }
 
 static void hw_init(void)
 {
-	// set the anode pins as an output
-	DDRB = _BV(PB2) | _BV(PB3) | _BV(PB4) | _BV(PB5);
-	DDRD = _BV(PD5) | _BV(PD6);
+	// set the anode and buzzer pins as an output
+	DDRB = GPIO_BIT(PIN_BUZZER) | GPIO_BIT(PIN_ANODE_DOT) |
+		   GPIO_BIT(PIN_ANODE_HL) | GPIO_BIT(PIN_ANODE_HH);
+	// PB0 is unused (or the DCF77 receiver supply or the PPS output), keep it low
+	DDRB |= _BV(PB0);
+	DDRD = GPIO_BIT(PIN_ANODE_MH) | GPIO_BIT(PIN_ANODE_ML);
 	// set the digit pins as an output
-	DDRC = _BV(PC0) | _BV(PC1) | _BV(PC2) | _BV(PC3);
+	DDRC = DIGIT_MASK;
 	
 	// enable pull-ups on button inputs
-	PORTD = _BV(PD3) | _BV(PD4);
+	PORTD = GPIO_BIT(PIN_BTN_HH) | GPIO_BIT(PIN_BTN_MM);
 	
 	// Enable IRQ0 on PD2 
-	MCUCR |= _BV(ISC00);
+	EICRA |= _BV(ISC00);
 	GICR |= _BV(INT0);
+	BTN_IRQ_INIT();
 
 	// Tubes' mux timer
+#if MUX_HWPWM == 1
+	// CTC, an IRQ at the end of each slot and at the PWM edges
+	TCCR0A = _BV(WGM01);
+	OCR0A = MUX_SLOT - 1;
+	OCR0B = 0xFF;
+	TIMSK0 |= _BV(OCIE0A) | _BV(OCIE0B);
+#else
 	// generate an IRQ on overflow
-	TIMSK |= _BV(TOIE0);
+	TIMSK0 |= _BV(TOIE0);
+#endif
 
 	// Fast PWM with ICR1 as TOP
 	// with OC1A as output pin (non-inverting)
@@ -183,123 +244,352 @@ static void hw_init(void)
 	DDRB |= _BV(PB1);
 
 	ICR1 = SMPS_PWM_PERIOD;
-	OCR1A = (ctx.duty_cycle*SMPS_PWM_PERIOD)/100;
-
-	// RTC timer
-	// clock div 128, normal mode
-	TCCR2 = _BV(CS22) | _BV(CS20);
-	// enable asynchronous operation
-	ASSR = _BV(AS2);
-	// generate an IRQ on timer overflow
-	TIMSK |= _BV(TOIE2);
+	SMPS_SET_DC(ctx.duty_cycle);
 
 	// Analog Comparator, rising edge
 	ACSR = _BV(ACBG) | _BV(ACIE) | _BV(ACIS1) | _BV(ACIS0);
 }
 
-// Tubes' mux handler - invoked at F_CPU/256 ~= 31.250 khz
+/* 
+ * Anode mapping:
+ * slot 0: HH -> PB5
+ * slot 1: HL -> PB4
+ * slot 2: MH -> PD5
+ * slot 3: ML -> PD6
+ * slot 4: DOT -> PB3
+ */
 static inline
-void digit_mux(void)
+void anode_on(uint8_t slot)
 {
-	static unsigned pwm_ocr = 0;
-	static unsigned pwm_cnt = 0;
-	static unsigned mux_cnt = 0;
-	static const pad_t *active_anode = anode_pad_map;
-
-	if (pwm_cnt + 1 < pwm_ocr) {
-		PAD_HIGH(active_anode);
-	} else {
-		PAD_LOW(active_anode);
+	switch (slot) {
+	case 0: GPIO_HIGH(PIN_ANODE_HH); break;
+	case 1: GPIO_HIGH(PIN_ANODE_HL); break;
+	case 2: GPIO_HIGH(PIN_ANODE_MH); break;
+	case 3: GPIO_HIGH(PIN_ANODE_ML); break;
+	default: GPIO_HIGH(PIN_ANODE_DOT); break;
 	}
+}
 
-	// this gives 625Hz PWM frequency 
-	if (++pwm_cnt == PWM_TOP) {
-		pwm_cnt = 0;
-	}
-	
-	// this gives 250Hz anode mulitplexing
-	if (mux_cnt++ < 128) {
-		return;
-	}
-	mux_cnt = 0;
+static uint8_t mux_slot = 0;
+static uint8_t mux_ocr = 0;
 
-	PAD_LOW(active_anode);
+// Switch over to the next slot, this gives 244Hz anode multiplexing
+static inline
+void mux_next(void)
+{
+	ANODES_OFF();
 	
-	if (active_anode < anode_pad_map + 4)
-		active_anode += 1;
-	else
-		active_anode = anode_pad_map;
+	if (++mux_slot > 4)
+		mux_slot = 0;
 	
-	if (active_anode < anode_pad_map + 4) {
-		int digit = ctx.digit[active_anode - anode_pad_map];
-		for (int i = 0; i < 4; i++) {
-			if (dt[digit] & _BV(i))
-				PAD_HIGH(&digit_pad_map[i]);
-			else
-				PAD_LOW(&digit_pad_map[i]);
-		}
-		pwm_ocr = PWM_TOP;
+#if ADC_SYNC == 1
+	// all anodes are off, sample HV in even slots and light in odd ones
+	adc_trigger((mux_slot & 1) ? ADC_VL : ADC_HV, mux_slot, adc_cb);
+#endif
+
+	if (mux_slot < 4) {
+		GPIO_WRITE_GROUP(DIGIT_PORT, DIGIT_MASK, digit_map[ctx.digit[mux_slot]]);
+		mux_ocr = ctx.ocr[mux_slot];
 	} else {
 		if (ctx.dot) {
-			ctx.dot_pwm += (ctx.dot_pwm < PWM_TOP*2/3) ? 1 : 0;
+			ctx.dot_pwm += (ctx.dot_pwm < DOT_PWM_MAX) ? DOT_PWM_STEP : 0;
 		} else  {
-			ctx.dot_pwm -= (ctx.dot_pwm > 0) ? 1 : 0;
+			ctx.dot_pwm -= (ctx.dot_pwm > 0) ? DOT_PWM_STEP : 0;
 		}
-		pwm_ocr = ctx.dot_pwm;
+		mux_ocr = (ctx.dot_pwm * ctx.ocr[4]) >> 7;
 	}
 }
 
-// RTC tick handler
+#if MUX_HWPWM == 1
+// Tubes' mux handler - invoked once a slot, at F_CPU/256/MUX_SLOT ~= 244 hz
+//
+// The IRQ comes in the last tick of the slot. Compare B lights the anode
+// MUX_BLANK ticks later and turns it off after mux_ocr more, at the
+// latest together with the next IRQ.
 static inline
-void rtc_tick(void)
+void digit_mux(void)
 {
-	ctx.poll = 1;
-	ctx.tick = 1;
-	ctx.dot ^= 1;
-	
-	if (ctx.time.ss < 59) {
-		ctx.time.ss++;
-		return;
+	mux_next();
+	OCR0B = mux_ocr ? MUX_BLANK - 1 : 0xFF;
+	// at full brightness the last slot's off compare matched together
+	// with this IRQ; left pending it would light the anode right away
+	TIFR0 = _BV(OCF0B);
+}
+
+ISR(TIMER0_COMPB_vect)
+{
+	if (OCR0B == MUX_BLANK - 1) {
+		anode_on(mux_slot);
+		OCR0B = MUX_BLANK - 1 + mux_ocr;
+	} else {
+		ANODES_OFF();
+	}
+}
+#else
+// Tubes' mux handler - invoked at F_CPU/256 ~= 31.250 khz
+static inline
+void digit_mux(void)
+{
+	static uint8_t mux_cnt = 0;
+
+	// the PWM is synchronous to the slot: the anode is lit
+	// for mux_ocr ticks, after MUX_BLANK ticks of blanking
+	if (mux_cnt == MUX_BLANK && mux_ocr) {
+		anode_on(mux_slot);
+	} else if (mux_cnt == mux_ocr + MUX_BLANK) {
+		ANODES_OFF();
 	}
-	ctx.time.ss = 0;
 
-	if (ctx.time.mm < 59) {
-		ctx.time.mm++;
+	if (++mux_cnt < MUX_SLOT) {
 		return;
 	}
-	ctx.time.mm = 0;
+	mux_cnt = 0;
 
-	if (ctx.time.hh < 23) {
-		ctx.time.hh++;
-		return;
+	mux_next();
+}
+#endif
+
+/**
+ * Update the per tube PWM from the brightness level and tube trims.
+ *
+ */
+static void set_brightness(uint8_t level)
+{
+	uint8_t ocr = pgm_read_byte(&gamma_map[level]);
+
+	for (int i = 0; i < 4; i++) {
+		int16_t trimmed = ocr * (100 + config.tube_trim[i]) / 100;
+
+		if (trimmed > MUX_OCR_MAX)
+			trimmed = MUX_OCR_MAX;
+		else if (ocr && trimmed < 1)
+			trimmed = 1;
+		ctx.ocr[i] = trimmed;
 	}
-	ctx.time.hh = 0;
+	ctx.ocr[4] = ocr;
+	ctx.brightness = level;
+}
+
+// RTC tick handler - invoked once a second
+static void rtc_tick(void)
+{
+	ctx.poll = 1;
+	ctx.tick = 1;
+	ctx.dot ^= 1;
+	dcf77_second();
 }
 
 /**
  * Function called when ADC conversion is done.
  *
  */
-int adc_cb(int channel, uint16_t value)
+int adc_cb(int channel, uint16_t value, uint8_t tag)
 {
 	if (channel == ADC_HV) {
+		pwr_hv_sample(value);
 		ctx.adc_hv = value;
-		return ADC_VL;
+		ctx.adc_hv_seq++;
+		channel = ADC_VL;
 	} else {
 		ctx.adc_light = value;
-		return ADC_HV;
+		channel = ADC_HV;
 	}
+
+	// conversions triggered by the mux are not chained
+	if (tag != ADC_TAG_NONE)
+		return -1;
+
+	// keep sampling for as long as the telemetry is streaming
+	return tlm_active() ? channel : -1;
 }
 
 /**
- * Initializes power saving mode from IRQ.
+ * Check if HV and light are sampled in the background.
  *
  */
-static void dc_toggle(void)
+static inline uint8_t adc_background(void)
 {
-	SMPS_OFF();
+	return (ADC_SYNC && !ctx.night) || tlm_active();
+}
+
+/**
+ * Start sampling in the background if telemetry needs it.
+ *
+ */
+static void adc_start(void)
+{
+	if (!ADC_SYNC && tlm_active())
+		adc_read(ADC_HV, adc_cb);
+}
+
+/**
+ * Duty cycle of the unit, see 'smps tune'.
+ *
+ */
+static uint8_t smps_dc(void)
+{
+	return config.smps_dc ? config.smps_dc : SMPS_PWM_DC;
+}
+
+/**
+ * Set the SMPS operating point from the config.
+ *
+ */
+static void smps_apply(void)
+{
+	ctx.duty_cycle = smps_dc();
+	pwr_set_point(config.smps_khz ? config.smps_khz : SMPS_PWM_FREQ, ctx.duty_cycle);
+}
+
+/**
+ * HV reading for pwr_tune().
+ *
+ */
+static uint16_t tune_read(void)
+{
+	uint16_t value;
+
+	// adc_cb() checks the background samples; wait for a fresh one, a
+	// slot triggered sample comes every few ms
+	if (adc_background()) {
+		uint8_t seq = ctx.adc_hv_seq;
+
+		for (uint8_t ms = 0; ctx.adc_hv_seq == seq && ms < TUNE_SAMPLE_MS; ms++)
+			_delay_ms(1);
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			value = ctx.adc_hv;
+		}
+		return value;
+	}
+
+	value = adc_read(ADC_HV, NULL);
+	pwr_hv_sample(value);
+	return value;
+}
+
+/**
+ * Send a telemetry sample.
+ *
+ */
+static void send_telemetry(void)
+{
+	rtc_stamp_t stamp;
+	clock_t now;
+
+	rtc_snapshot(&stamp, &now);
+
+	tlm_sample_t sample = {
+		.adc_hv = ctx.adc_hv,
+		.adc_light = ctx.adc_light,
+		.duty_cycle = ctx.duty_cycle,
+		.dcf_state = dcf_state,
+		.hh = now.hh,
+		.mm = now.mm,
+		.ss = now.ss,
+		.subticks = stamp.subticks,
+		.dcf_sync_cnt = ctx.dcf_sync_cnt,
+	};
+
+	tlm_send(&sample);
+}
+
+#if BENCH == 1
+static queue_t *const bench_queue_q = Q_INIT(UART_QUEUE_SIZE);
+
+// 12:01 on Wednesday, 2014-01-01, CET
+static const dcf_frame_t bench_frame = { .bits = 0x502c1250340000ULL };
+
+static void bench_queue(void)
+{
+	uint8_t b;
+
+	q_put(bench_queue_q, 0x55);
+	q_get(bench_queue_q, &b);
+}
+
+static void bench_log(void)
+{
+	char line[32];
+
+	snprintf_P(line, sizeof(line), PSTR("HV:%ld Light:%d DC:%d"), 170L, ctx.adc_light, 80);
+}
+
+static void bench_dcf(void)
+{
+	dcf_time_t t;
+
+	dcf77_decode(&bench_frame, &t);
+}
+
+static void bench_adc(void)
+{
+	adc_read(ADC_HV, NULL);
+}
+
+static void bench_refresh(void)
+{
+	clock_t now;
+
+	rtc_get_time(&now);
+	refresh_display(&now);
+}
+
+/**
+ * Run a benchmark and print its cycles. Returns 0 if the supply failed.
+ *
+ */
+static uint8_t bench_item(PGM_P name, bench_fn_t fn)
+{
+	bench_result_t r;
+
+	if (pwr_state != PWR_ON)
+		return 0;
+
+	bench_run(fn, &r);
+	log_info("%S: min %u, avg %u, max %u cycles", name, r.min, r.avg, r.max);
+	return 1;
+}
+
+/**
+ * Run the benchmark suite, see bench.h. The tubes are off meanwhile;
+ * the mux ISR is called directly (its reti enables IRQs, it may be
+ * preempted, see min), refresh_display() and the ADC see the real
+ * inputs. The rest of refresh() acts on the clock's state, e.g. the night
+ * mode would stop Timer1, and isn't timed.
+ *
+ */
+static void run_bench(void)
+{
+	uint8_t mux = TCCR0 & MUX_CS;
+
+	if (pwr_state != PWR_ON) {
+		log_warn("Not on mains");
+		return;
+	}
+	if (ctx.night) {
+		log_warn("Night mode");
+		return;
+	}
+
 	DMUX_STOP();
+	ANODES_OFF();
+	bench_begin();
+
+	bench_item(PSTR("queue put+get"), bench_queue) &&
+		bench_item(PSTR("log format"), bench_log) &&
+		bench_item(PSTR("dcf decode"), bench_dcf) &&
+		bench_item(PSTR("refresh display"), bench_refresh) &&
+		bench_item(PSTR("adc read"), bench_adc) &&
+		bench_item(PSTR("mux isr"), MUX_vect);
+
+	// after a supply failure pwr_fail() owns Timer1 and the mux
+	if (pwr_state == PWR_ON) {
+		bench_end();
+		if (mux)
+			DMUX_START();
+	}
 }
+#endif
 
 /**
  * Character received callback.
@@ -318,6 +608,19 @@ static void parse_command(void)
 	static char buffer[15] = {0};
 	static unsigned i = 0;
 	char *bp;
+	clock_t t;
+
+#if CHAIN == 1
+	// a follower's RX is the upstream clock's TX, whose text is its log
+	// and its console echo: nothing to run here nor to pass on
+	if (chain.role == CHAIN_FOLLOWER) {
+		uint8_t c;
+		while (uart_read(0, &c, 1))
+			;
+		ctx.uart = 0;
+		return;
+	}
+#endif
 
 	ctx.input = 1;
 	
@@ -330,26 +633,122 @@ static void parse_command(void)
 	ctx.uart = 0;
 
 	if (buffer[i - 1] == '\r' || buffer[i - 1] == '\n') {
+		TRACE_EVENT(TRACE_CMD, buffer[0]);
 		if ((bp = strstr(buffer, "smps off"))) {
 			SMPS_OFF();
 			DMUX_STOP();
 		} else if ((bp = strstr(buffer, "smps on"))) {
-			SMPS_ON();
-			DMUX_START();
+			// a trip is only cleared by pwr_hv_check()
+			if (!pwr_trip.tripped) {
+				SMPS_ON();
+				DMUX_START();
+			}
 		} else if ((bp = strstr(buffer, "smps dc"))) {
 			ctx.duty_cycle = atoi(bp + 8);
 			SMPS_SET_DC(ctx.duty_cycle);
+		} else if ((bp = strstr(buffer, "smps tune"))) {
+			// smps tune [hv]
+			pwr_point_t best;
+			uint8_t hv = bp[9] == ' ' ? atoi(bp + 10) : PWR_TUNE_HV;
+			if (pwr_state == PWR_ON && !pwr_trip.tripped && (TCCR1B & _BV(CS10)) &&
+				pwr_tune(hv, tune_read, &best)) {
+				config.smps_khz = best.khz;
+				config.smps_dc = best.dc;
+				config_save();
+				log_info("SMPS tuned to %ukHz %u%%, %uV", best.khz, best.dc, best.hv);
+			}
+			if (!pwr_trip.tripped)
+				smps_apply();
+		} else if ((bp = strstr(buffer, "smps def"))) {
+			config.smps_khz = 0;
+			config.smps_dc = 0;
+			config_save();
+			smps_apply();
+		} else if ((bp = strstr(buffer, "bri"))) {
+			int level = atoi(bp + 4);
+			if (bp[3] == ' ' && level >= 0 && level <= BRI_MAX) {
+				config.brightness = level;
+				config_save();
+				set_brightness(level);
+			}
+			log_info("Brightness %d", ctx.brightness);
+		} else if ((bp = strstr(buffer, "trim"))) {
+			int tube = atoi(bp + 5);
+			int trim = atoi(bp + 7);
+			if (bp[4] == ' ' && bp[6] == ' ' && tube >= 0 && tube < 4 &&
+				trim >= -BRI_TRIM_MAX && trim <= BRI_TRIM_MAX) {
+				config.tube_trim[tube] = trim;
+				config_save();
+				set_brightness(ctx.brightness);
+			}
+			log_info("Trim %d %d %d %d%%", config.tube_trim[0], config.tube_trim[1],
+					 config.tube_trim[2], config.tube_trim[3]);
+		} else if ((bp = strstr(buffer, "tlm off"))) {
+			tlm_set_rate(0);
+		} else if ((bp = strstr(buffer, "tlm"))) {
+			if (bp[3] == ' ') {
+				// the ADC conversions are chained from adc_cb() while streaming
+				uint8_t idle = !adc_background();
+				tlm_set_rate(atoi(bp + 4));
+				if (idle)
+					adc_start();
+			}
+			log_info("Telemetry %uHz", tlm_rate());
 		} else if (strstr(buffer, "beep")) {
 			ctx.beep = 1;
+#if NIGHT_MODE == 1
+		} else if ((bp = strstr(buffer, "night"))) {
+			// night l <light>, night d <minutes>, night w <from> <to>,
+			// night w off
+			uint8_t save = 0;
+
+			if (bp[5] == ' ' && bp[6] && bp[7] == ' ') {
+				int value = atoi(bp + 8);
+				char *to = strchr(bp + 8, ' ');
+				uint8_t num = bp[8] >= '0' && bp[8] <= '9';
+
+				if (bp[6] == 'l' && num) {
+					config.night_light = value;
+					save = 1;
+				} else if (bp[6] == 'd' && num) {
+					config.night_dwell = value;
+					save = 1;
+				} else if (bp[6] == 'w' && num && to && to[1] >= '0' && to[1] <= '9') {
+					int end = atoi(to + 1);
+					if (value < 24 && end < 24 && end != value) {
+						config.night_from = value;
+						config.night_to = end;
+						save = 1;
+					}
+				} else if (bp[6] == 'w' && !strncmp(bp + 8, "off", 3)) {
+					config.night_from = config.night_to = 0;
+					save = 1;
+				}
+			}
+			if (save)
+				config_save();
+			log_info("Night %S, light %u/%u, dark %us/%umin, window %u-%u",
+					 ctx.night ? PSTR("on") : PSTR("off"),
+					 ctx.light_avg, config.night_light, ctx.night_dark,
+					 config.night_dwell, config.night_from, config.night_to);
+#endif
+		} else if (strstr(buffer, "uart")) {
+			uart_stats_t s;
+			uart_stats(UART0, &s);
+			log_info("Overrun %u, framing %u, parity %u, rx full %u, tx full %u",
+					 s.overrun, s.framing, s.parity, s.rx_full, s.tx_full);
 		} else if (strstr(buffer, "reset")) {
-			while (1);
+			diag_reset();
+		} else if (strstr(buffer, "diag")) {
+			diag_report();
 		} else if ((bp = strstr(buffer, "set"))) {
 			bp[6] = 0;	
 			bp[9] = 0;
 			bp[12] = 0;
-			ctx.time.hh = atoi(bp + 4);
-			ctx.time.mm = atoi(bp + 7);
-			ctx.time.ss = atoi(bp + 10);
+			t.hh = atoi(bp + 4);
+			t.mm = atoi(bp + 7);
+			t.ss = atoi(bp + 10);
+			rtc_set_time(&t);
 		} else if ((bp = strstr(buffer, "alarm"))) {
 			bp[8] = 0;	
 			bp[11] = 0;
@@ -369,10 +768,108 @@ static void parse_command(void)
 			else
 				ctx.debug = 0;
 		} else if ((bp = strstr(buffer, "dcf"))) {
-			log_info("Sync cnt %d, last sync %02d/%02d/%02d %02d:%02d:%02d", \
+			log_info("Sync cnt %d, last sync %02d/%02d/%02d %02d:%02d %S%S%S", \
 					 ctx.dcf_sync_cnt, 
 					 dcf_time.day, dcf_time.month, dcf_time.year, 
-					 dcf_time.hour, dcf_time.minute);
+					 dcf_time.hour, dcf_time.minute,
+					 (dcf_time.flags & _BV(DCF_F_CEST)) ? PSTR("CEST") : PSTR("CET"),
+					 (dcf_time.flags & _BV(DCF_F_DST_ANNOUNCEMENT)) ? PSTR(" DST") : PSTR(""),
+					 (dcf_time.flags & _BV(DCF_F_ABNORMAL_OPERATION)) ? PSTR(" CALL") : PSTR(""));
+			log_info("Edges %u, glitches %u, storms %u%S",
+					 dcf_stats.edges, dcf_stats.glitches, dcf_stats.storms,
+					 dcf_polled ? PSTR(", polling") : PSTR(""));
+#if DCF_SCHED == 1
+			log_info("Receiver %S, windows %u, on %lus, failures %u, error %ums",
+					 dcfsched.open ? PSTR("on") : PSTR("off"),
+					 dcfsched.windows, dcfsched.on_time + dcfsched.window,
+					 dcfsched.failures, dcfsched_error());
+#endif
+		} else if (strstr(buffer, "pwr")) {
+			log_info("Backups %u, %lus, wakes %lu, polls %lu, awake %luus/wake",
+					 pwr_stats.backups, pwr_stats.seconds, pwr_stats.wakes, pwr_stats.polls,
+					 pwr_stats.wakes ? pwr_stats.cycles / pwr_stats.wakes / (F_CPU/1000000UL) : 0);
+			log_info("Shutdown %u/%uus, resume %u/%ums, timeouts %u, aborts %u",
+					 pwr_stats.latency, pwr_stats.latency_max,
+					 pwr_stats.resume, pwr_stats.resume_max,
+					 pwr_stats.timeouts, pwr_stats.aborts);
+			pwr_trip_t trip;
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				trip = pwr_trip;
+			}
+			log_info("HV trips %u, last %luV at %lu, back-off %us",
+					 trip.count, HV_FROM_ADC(trip.peak),
+					 trip.stamp.seconds, trip.backoff);
+#if CHAIN == 1
+		} else if ((bp = strstr(buffer, "chain"))) {
+			if (bp[5] == ' ') {
+				if (bp[6] == 'm')
+					config.chain = CHAIN_MASTER;
+				else if (bp[6] == 'f')
+					config.chain = CHAIN_FOLLOWER;
+				else
+					config.chain = CHAIN_OFF;
+				config_save();
+				chain_init(config.chain);
+			}
+			log_info("Chain %S, hops %u, age %umin, rx %u, tx %u, busy %u, syncs %u, errors %u",
+					 chain.role == CHAIN_MASTER ? PSTR("master") :
+					 chain.role == CHAIN_FOLLOWER ? PSTR("follower") : PSTR("off"),
+					 chain.hops, chain.age, chain.rx, chain.tx, chain.busy,
+					 chain.syncs, frame_rx_errors);
+#endif
+#if HOST_SYNC == 1
+		} else if (strstr(buffer, "hsync")) {
+			log_info("Host sync: requests %u, busy %u, adjusts %u, offset %ldms, errors %u",
+					 hsync.requests, hsync.busy, hsync.adjusts,
+					 hsync.offset * 1000 / RTC_TICKS_PER_SEC, frame_rx_errors);
+#endif
+#if TRACE == 1
+		} else if ((bp = strstr(buffer, "trace"))) {
+			// trace a(rm), f(reeze), d(ump), m <mask>, t <triggers>
+			if (bp[5] == ' ') {
+				if (bp[6] == 'a')
+					trace_arm();
+				else if (bp[6] == 'f')
+					trace_trigger(TRACE_T_CONSOLE);
+				else if (bp[6] == 'd')
+					trace_dump();
+				else if (bp[6] == 'm' && bp[7] == ' ')
+					trace.mask = strtoul(bp + 8, NULL, 16) | _BV(TRACE_C_TRIGGER);
+				else if (bp[6] == 't' && bp[7] == ' ')
+					trace.triggers = strtoul(bp + 8, NULL, 16);
+			}
+			log_info("Trace %S, records %u, mask 0x%02x, triggers 0x%02x, reason %u",
+					 trace.frozen ? PSTR("frozen") : trace.post ? PSTR("triggered") : PSTR("running"),
+					 trace.count, trace.mask, trace.triggers, trace.reason);
+#endif
+#if PROF == 1
+		} else if ((bp = strstr(buffer, "prof"))) {
+			// prof s(tart) [step], x (stop), d(ump), r <lo> <shift>
+			if (bp[4] == ' ') {
+				if (bp[5] == 's')
+					prof_start(bp[6] == ' ' ? atoi(bp + 7) : PROF_STEP_DEF);
+				else if (bp[5] == 'x')
+					prof_stop();
+				else if (bp[5] == 'd')
+					prof_dump();
+				else if (bp[5] == 'r' && bp[6] == ' ') {
+					char *end;
+					uint16_t lo = strtoul(bp + 7, &end, 16);
+					prof_range(lo, atoi(end));
+				}
+			}
+			log_info("Prof %S, step %u, samples %u, other %u, lo 0x%04x, shift %u",
+					 prof.running ? PSTR("running") : PSTR("stopped"), prof.step,
+					 prof.samples, prof.other, prof.lo, prof.shift);
+#endif
+#if BENCH == 1
+		} else if (strstr(buffer, "bench")) {
+			run_bench();
+#endif
+		} else if (strstr(buffer, "drift")) {
+			log_info("Trim %ldppb, offset %ldms, syncs %u, estimates %u",
+					 (int32_t)rtc_get_trim() * 10, rtc_drift.offset * 1000 / RTC_TICKS_PER_SEC,
+					 rtc_drift.syncs, rtc_drift.estimates);
 		}
 
 		i = 0;
@@ -387,24 +884,222 @@ static void parse_command(void)
 	buffer[i] = 0;
 }
 
+/**
+ * Save a new RTC trim estimate.
+ *
+ */
+static void trim_updated(void)
+{
+	config.rtc_trim = rtc_get_trim();
+	config_save();
+	DIAG_EVENT(DIAG_EV_RTC_TRIM);
+	log_info("RTC trim %ldppb", (int32_t)config.rtc_trim * 10);
+}
+
+/**
+ * Decode the DCF77 frame which ended at the last minute mark and
+ * lock the RTC to it.
+ *
+ */
+static void dcf_sync(void)
+{
+	dcf_frame_t frame;
+	rtc_stamp_t mark;
+	dcf_time_t t;
+
+	cli();
+	frame = dcf_frame;
+	mark = dcf_mark;
+	sei();
+
+	if (!dcf77_decode(&frame, &t)) {
+		if (ctx.dcf_debug)
+			log_debug("DCF frame rejected");
+		return;
+	}
+
+	if ((t.flags & _BV(DCF_F_DST_ANNOUNCEMENT)) && !(dcf_time.flags & _BV(DCF_F_DST_ANNOUNCEMENT)))
+		log_info("DCF: DST change announced");
+	if ((t.flags & _BV(DCF_F_LEAP_SECOND)) && !(dcf_time.flags & _BV(DCF_F_LEAP_SECOND)))
+		log_info("DCF: leap second announced");
+
+	dcf_time = t;
+	ctx.dcf_sync_cnt++;
+	DIAG_EVENT(DIAG_EV_DCF_SYNC);
+#if DCF_SCHED == 1
+	dcfsched_frame(&t);
+#endif
+
+	clock_t ref = {
+		.hh = t.hour,
+		.mm = t.minute,
+		.ss = 0,
+	};
+	uint8_t trimmed = rtc_discipline(&mark, &ref, 0);
+#if CHAIN == 1
+	chain_synced();
+#endif
+	if (trimmed)
+		trim_updated();
+}
+
+/**
+ * Check for the alarm time.
+ *
+ */
+static void check_alarm(const clock_t *now)
+{
+	if (now->hh == ctx.alarm.hh && now->mm == ctx.alarm.mm && now->ss == ctx.alarm.ss) {
+		ctx.beep = 1;
+		ctx.wake = 1;
+	}
+}
+
+#if NIGHT_MODE == 1
+static void night_enter(void)
+{
+	SMPS_OFF();
+	DMUX_STOP();
+	ANODES_OFF();
+	// stops the background sampling, refresh() reads the light itself
+	adc_init(ADC_INT, ADC_PRE128, 0);
+
+	ctx.night = 1;
+	// GICR is shared with the DCF77 IRQ, which changes it from IRQ context
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		BTN_IRQ_ON();
+	}
+	log_info("Night on");
+}
+
+static void night_exit(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		BTN_IRQ_OFF();
+	}
+	ctx.night = 0;
+	log_info("Night off");
+
+	// leaves pwr_state at PWR_FAIL if the supply failed meanwhile
+	if (pwr_resume(ctx.duty_cycle))
+		adc_start();
+}
+
+/**
+ * Turn the tubes off after night_dwell minutes of darkness or within the
+ * night window, and back on when the light rises, at the end of the
+ * window, on a button press or on the alarm. Called once a second.
+ *
+ */
+static void night_check(const clock_t *now)
+{
+	uint8_t window;
+
+	// filtered light, higher readings are darker
+	if (ctx.light_avg == 0)
+		ctx.light_avg = ctx.adc_light;
+	ctx.light_avg += ((int16_t)ctx.adc_light - (int16_t)ctx.light_avg) / 8;
+
+	if (config.night_light && ctx.light_avg > config.night_light) {
+		if (ctx.night_dark < UINT16_MAX)
+			ctx.night_dark++;
+	} else if (!config.night_light || ctx.light_avg + NIGHT_LIGHT_HYST < config.night_light) {
+		ctx.night_dark = 0;
+	}
+
+	if (config.night_from <= config.night_to)
+		window = now->hh >= config.night_from && now->hh < config.night_to;
+	else
+		window = now->hh >= config.night_from || now->hh < config.night_to;
+
+	if (ctx.night && (!BTN_HH || !BTN_MM)) {
+		// the press only wakes the tubes up
+		ctx.poll = 0;
+		ctx.wake = 1;
+	}
+
+	if (ctx.wake) {
+		ctx.wake = 0;
+		ctx.night_hold = NIGHT_HOLD;
+		if (ctx.night)
+			night_exit();
+		return;
+	}
+
+	if (ctx.night_hold) {
+		ctx.night_hold--;
+		return;
+	}
+
+	if (!ctx.night) {
+		if (window || ctx.night_dark >= config.night_dwell * 60U)
+			night_enter();
+	} else if (!window && ctx.night_dark == 0) {
+		night_exit();
+	}
+}
+
+/**
+ * Pick the deepest sleep mode that keeps everything running which
+ * needs to: power-save stops clkIO, so the UART, the ADC and the DCF77
+ * edge IRQ stop too.
+ *
+ */
+static uint8_t night_sleep_mode(void)
+{
+	if (!ctx.night || tlm_active() || !uart_tx_idle(UART0))
+		return SLEEP_MODE_IDLE;
+#if DCF_SCHED == 1
+	if (!dcfsched.open) {
+		// after a Timer2 wake-up its IRQ logic needs a TOSC1 cycle
+		rtc_settle();
+		return SLEEP_MODE_PWR_SAVE;
+	}
+#endif
+	return SLEEP_MODE_IDLE;
+}
+#endif
+
 static void check_buttons(void)
 {
+	clock_t t;
+
 	if (BTN_HH == 0) {
 		// debounce
 		_delay_ms(20);
 		if (BTN_HH == 0) {
-			ctx.time.hh = (ctx.time.hh < 23) ? ctx.time.hh + 1 : 0;
+			rtc_get_time(&t);
+			t.hh = (t.hh < 23) ? t.hh + 1 : 0;
+			rtc_set_time(&t);
 		}
 	}
 	if (BTN_MM == 0) {
 		// debounce
 		_delay_ms(20);
 		if (BTN_MM == 0) {
-			ctx.time.mm = (ctx.time.mm < 59) ? ctx.time.mm + 1 : 0;
+			rtc_get_time(&t);
+			t.mm = (t.mm < 59) ? t.mm + 1 : 0;
+			rtc_set_time(&t);
 		}
 	}
 }
 
+/**
+ * Set the digits and read the light sensor, unless it is sampled in the
+ * background.
+ *
+ */
+static void refresh_display(const clock_t *now)
+{
+	ctx.digit[0] = now->hh / 10;
+	ctx.digit[1] = now->hh % 10;
+	ctx.digit[2] = now->mm / 10;
+	ctx.digit[3] = now->mm % 10;
+
+	if (!adc_background())
+		ctx.adc_light = adc_read(ADC_VL, NULL);
+}
+
 /**
  * Update display.
  * 
@@ -414,21 +1109,35 @@ static void check_buttons(void)
  */
 static void refresh(void)
 {
-	ctx.digit[0] = ctx.time.hh / 10;
-	ctx.digit[1] = ctx.time.hh % 10;
-	ctx.digit[2] = ctx.time.mm / 10;
-	ctx.digit[3] = ctx.time.mm % 10;
+	clock_t now;
 
-	ctx.adc_light = adc_read(ADC_VL, NULL);
+	rtc_get_time(&now);
+	refresh_display(&now);
 
 #if ADAPTIVE_DC == 1
-	ctx.duty_cycle = SMPS_PWM_DC;
+	// the map is for SMPS_PWM_DC, scale it to the unit's duty cycle
+	ctx.duty_cycle = smps_dc();
 	for (int i = 0; i < sizeof(dc_light_map)/sizeof(dc_light_map[0]); i++) {
 		if (ctx.adc_light > dc_light_map[i][0])
-			ctx.duty_cycle = dc_light_map[i][1];
+			ctx.duty_cycle = dc_light_map[i][1] * smps_dc() / SMPS_PWM_DC;
 	}
 	SMPS_SET_DC(ctx.duty_cycle);
 #endif
+
+#if ADAPTIVE_BRI == 1
+	uint8_t level = config.brightness;
+	for (int i = 0; i < sizeof(bri_light_map)/sizeof(bri_light_map[0]); i++) {
+		if (ctx.adc_light > bri_light_map[i][0] && bri_light_map[i][1] < level)
+			level = bri_light_map[i][1];
+	}
+	if (level != ctx.brightness)
+		set_brightness(level);
+#endif
+
+	check_alarm(&now);
+#if NIGHT_MODE == 1
+	night_check(&now);
+#endif
 }
 
 /**
@@ -438,65 +1147,145 @@ static void refresh(void)
 __attribute__((OS_main))
 int main(void)
 {
+	diag_init();
+#if TRACE == 1
+	trace_init();
+#endif
 	hw_init();
+	config_load();
+	smps_apply();
+	rtc_init(rtc_tick);
+	rtc_set_trim(config.rtc_trim);
+	set_brightness(config.brightness);
+#if DCF_SCHED == 1
+	dcfsched_init();
+#endif
 
 	uart_init(UART0, UART_BAUD_SELECT(UART_BAUD_RATE), uart_rx_cb, NULL);
 	log_init();
+#if CHAIN == 1 || HOST_SYNC == 1
+	uart_set_filter(UART0, frame_rx);
+#endif
+#if CHAIN == 1
+	// a follower takes no commands, both buttons held at power up start
+	// it with the chain off until 'chain' is used
+	if (!BTN_HH && !BTN_MM)
+		config.chain = CHAIN_OFF;
+	chain_init(config.chain);
+#endif
 
 	sei();
 	
 	log_info("Init done!");
+	diag_report();
 
 	while (1) {
 		adc_init(ADC_INT, ADC_PRE128, 0);
-		
-		SMPS_ON();
-		DMUX_START();
 
-		wdt_enable(WDTO_2S);
-		set_sleep_mode(SLEEP_MODE_IDLE);
+#if DCF_SCHED == 1
+		// the receiver supply is cut in backup mode
+		if (dcfsched.open)
+			DCF_PWR_PORT |= _BV(DCF_PWR_PIN);
+#endif
+		DIAG_CHECKPOINT(DIAG_CP_RESUME);
+		// the loop below is skipped if the supply failed meanwhile
+		if (pwr_resume(ctx.duty_cycle)) {
+			adc_start();
 
-		while (bit_is_clear(ACSR, ACO)) {
+			wdt_enable(WDTO_2S);
+			set_sleep_mode(SLEEP_MODE_IDLE);
+		}
+
+		while (pwr_state == PWR_ON) {
 			if (ctx.tick) {
 				ctx.tick = 0;
+				DIAG_CHECKPOINT(DIAG_CP_REFRESH);
 				refresh();
+				if (!ctx.night) {
+					// without background sampling HV is only checked here
+					if (!adc_background())
+						pwr_hv_sample(adc_read(ADC_HV, NULL));
+					pwr_hv_check(ctx.duty_cycle);
+				}
+#if DCF_SCHED == 1
+#if CHAIN == 1
+				if (chain.role != CHAIN_FOLLOWER)
+#endif
+					dcfsched_second();
+#endif
+#if CHAIN == 1
+				chain_second();
+#endif
 				if (ctx.debug && !ctx.input) {
-					ctx.adc_hv = adc_read(ADC_HV, NULL);
+					if (!adc_background())
+						ctx.adc_hv = adc_read(ADC_HV, NULL);
 					uint32_t hv = HV_FROM_ADC(ctx.adc_hv);
 					log_debug("HV:%ld Light:%d DC:%d", hv, ctx.adc_light, ctx.duty_cycle);
-					log_debug("Local time: %02d:%02d:%02d", ctx.time.hh, ctx.time.mm, ctx.time.ss);
+					clock_t now;
+					rtc_get_time(&now);
+					log_debug("Local time: %02d:%02d:%02d", now.hh, now.mm, now.ss);
 				}
 			}
 
 			if (ctx.uart) {
+				DIAG_CHECKPOINT(DIAG_CP_COMMAND);
 				parse_command();
 			}
 
+			if (ctx.tlm) {
+				ctx.tlm = 0;
+				DIAG_CHECKPOINT(DIAG_CP_TLM);
+				send_telemetry();
+			}
+
 			if (ctx.beep) {
 				ctx.beep = 0;
-				PAD_HIGH(&buzzer_pad);
+				DIAG_CHECKPOINT(DIAG_CP_BEEP);
+				GPIO_HIGH(PIN_BUZZER);
 				_delay_ms(20);
-				PAD_LOW(&buzzer_pad);
+				GPIO_LOW(PIN_BUZZER);
 			}
 
 			if (ctx.poll) {
 				ctx.poll = 0;
+				DIAG_CHECKPOINT(DIAG_CP_BUTTONS);
 				check_buttons();
 			}
 
-			if (ctx.dcf_sync) {
-				ctx.dcf_sync = 0;
-				ctx.time.hh = dcf_time.hour;
-				ctx.time.mm = dcf_time.minute;
-				ctx.time.ss = 0;
+			if (ctx.dcf_frame) {
+				ctx.dcf_frame = 0;
+				DIAG_CHECKPOINT(DIAG_CP_DCF);
+				dcf_sync();
 			}
 
+#if CHAIN == 1 || HOST_SYNC == 1
+			frame_rx_t frame;
+			if (frame_read(&frame)) {
+				uint8_t trimmed = 0;
+				DIAG_CHECKPOINT(DIAG_CP_FRAME);
+#if CHAIN == 1
+				trimmed |= chain_frame(&frame);
+#endif
+#if HOST_SYNC == 1
+				trimmed |= hsync_frame(&frame);
+#endif
+				if (trimmed)
+					trim_updated();
+			}
+#endif
+
 			if (ctx.dcf_irq && ctx.dcf_debug && !ctx.input) {
 				ctx.dcf_irq = 0;
 				log_debug("DCF state: %d", dcf_state);
 			}
 
+			DIAG_CHECKPOINT(DIAG_CP_SLEEP);
+#if NIGHT_MODE == 1
+			set_sleep_mode(night_sleep_mode());
+#endif
+			TRACE_EVENT(TRACE_SLEEP, SMCR);
 			sleep_mode();
+			TRACE_EVENT(TRACE_WAKE, 0);
 			wdt_reset();
 		}
 
@@ -505,19 +1294,13 @@ int main(void)
 		adc_deinit();
 		uart_deinit(UART0);
 
-		PORTB &= 0xE0;
-		PORTC &= 0xF0;
-		PORTD &= 0x9C;
-
-		set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+		DIAG_CHECKPOINT(DIAG_CP_BACKUP);
+#if PROF == 1
+		// it would wake the CPU in backup mode
+		prof_stop();
+#endif
+		pwr_backup();
 
-		while (bit_is_set(ACSR, ACO)) {
-			ACSR |= _BV(ACD);
-			_delay_us(50);
-			sleep_mode();
-			ACSR &= ~_BV(ACD);
-		}
-		
 		uart_init(UART0, UART_BAUD_SELECT(UART_BAUD_RATE), uart_rx_cb, NULL);
 	}
 }
@@ -22,6 +22,9 @@
 #define _MINIXIE_H_
 
 #include "logger.h"
+#include "gpio.h"
+#include "mcu.h"
+#include "rtc.h"
 
 #ifndef F_CPU
 #define F_CPU 8000000UL
@@ -32,8 +35,12 @@
 #endif
 
 #ifndef UART_QUEUE_SIZE
+#if MCU_BIG_RAM == 1
+#define UART_QUEUE_SIZE 200
+#else
 #define UART_QUEUE_SIZE 50
 #endif
+#endif
 
 #ifndef UART_BAUD_RATE
 #define UART_BAUD_RATE  19200
@@ -43,19 +50,101 @@
 #define ADAPTIVE_DC     0
 #endif
 
+// power the DCF77 receiver in sync windows only, see dcfsched.h
+#ifndef DCF_SCHED
+#define DCF_SCHED       0
+#endif
+
+// let the UART preempt the mux and DCF77 IRQ handlers
+#ifndef IRQ_NESTING
+#define IRQ_NESTING     1
+#endif
+
+// turn the tubes off when it's dark or at scheduled hours
+#ifndef NIGHT_MODE
+#define NIGHT_MODE      1
+#endif
+
+// sample HV and light from the mux IRQ, in the blanking gap of each slot
+#ifndef ADC_SYNC
+#define ADC_SYNC        1
+#endif
+
+// share the time with other clocks over the UART, see chain.h
+#ifndef CHAIN
+#define CHAIN           0
+#endif
+
+// NTP style time sync with a host over the UART, see hostsync.h
+#ifndef HOST_SYNC
+#define HOST_SYNC       0
+#endif
+
+// dim the tubes with the mux PWM depending on ambient light
+#ifndef ADAPTIVE_BRI
+#define ADAPTIVE_BRI    0
+#endif
+
 // OC1A = PB1
 // OC1B = PB2
 // SMPS default params
-#define SMPS_PWM_FREQ   50
-#define SMPS_PWM_PERIOD (F_CPU/SMPS_PWM_FREQ/1000)
-#define SMPS_PWM_DC     80 // in %
+#define SMPS_PWM_FREQ   50 // in kHz, config.smps_khz overrides it
+#define SMPS_PERIOD(khz) (F_CPU/(khz)/1000)
+#define SMPS_PWM_PERIOD SMPS_PERIOD(SMPS_PWM_FREQ)
+#define SMPS_PWM_DC     80 // in %, config.smps_dc overrides it
 #define SMPS_ON()       do { TCCR1B |= _BV(CS10); TCCR1A |= _BV(COM1A1); } while (0) //no prescaling
 #define SMPS_OFF()      do { TCCR1B &= ~(_BV(CS21) | _BV(CS11) | _BV(CS10)); TCCR1A &= ~_BV(COM1A1); } while (0)
-#define SMPS_SET_DC(dc) (OCR1A = (dc*SMPS_PWM_PERIOD)/100)
+#define SMPS_SET_DC(dc) (OCR1A = ((uint32_t)(dc)*ICR1)/100)
+#define TUNE_SAMPLE_MS  20 // longest wait for a background HV sample in 'smps tune'
 
 // buttons pins
-#define BTN_HH          (PIND & _BV(PD4))
-#define BTN_MM          (PIND & _BV(PD3))
+#define PIN_BTN_HH      D, 4
+#define PIN_BTN_MM      D, 3
+#define BTN_HH          GPIO_READ(PIN_BTN_HH)
+#define BTN_MM          GPIO_READ(PIN_BTN_MM)
+
+// wake-up IRQ of the buttons while the tubes sleep: the MM button's INT1
+// (low level) on the ATmega8, a pin change of either on the others
+#if MCU_MX8 == 1
+#define BTN_vect        PCINT2_vect
+#define BTN_IRQ_INIT()  (PCMSK2 = _BV(PCINT19) | _BV(PCINT20))
+#define BTN_IRQ_ON()    do { PCIFR = _BV(PCIF2); PCICR |= _BV(PCIE2); } while (0)
+#define BTN_IRQ_OFF()   (PCICR &= ~_BV(PCIE2))
+#else
+#define BTN_vect        INT1_vect
+#define BTN_IRQ_INIT()  ((void)0)
+#define BTN_IRQ_ON()    do { GIFR = _BV(INTF1); GICR |= _BV(INT1); } while (0)
+#define BTN_IRQ_OFF()   (GICR &= ~_BV(INT1))
+#endif
+
+// anodes, one per mux slot
+#define PIN_ANODE_HH    B, 5
+#define PIN_ANODE_HL    B, 4
+#define PIN_ANODE_MH    D, 5
+#define PIN_ANODE_ML    D, 6
+#define PIN_ANODE_DOT   B, 3
+
+#define ANODES_OFF()    do { GPIO_LOW(PIN_ANODE_HH); GPIO_LOW(PIN_ANODE_HL); \
+                             GPIO_LOW(PIN_ANODE_MH); GPIO_LOW(PIN_ANODE_ML); \
+                             GPIO_LOW(PIN_ANODE_DOT); } while (0)
+
+// 74141 BCD inputs A, B, C, D
+#define DIGIT_PORT      C
+#define DIGIT_A         PC0
+#define DIGIT_B         PC2
+#define DIGIT_C         PC3
+#define DIGIT_D         PC1
+#define DIGIT_MASK      (_BV(DIGIT_A) | _BV(DIGIT_B) | _BV(DIGIT_C) | _BV(DIGIT_D))
+
+// BCD code n as written to DIGIT_PORT
+#define DIGIT_BITS(n)   ((((n) & 1) ? _BV(DIGIT_A) : 0) | (((n) & 2) ? _BV(DIGIT_B) : 0) | \
+                         (((n) & 4) ? _BV(DIGIT_C) : 0) | (((n) & 8) ? _BV(DIGIT_D) : 0))
+
+#define PIN_BUZZER      B, 2
+
+// night mode
+#define NIGHT_LIGHT_HYST 50             // light has to rise that much to wake up
+#define NIGHT_HOLD       60             // time the tubes stay on after a wake up, in s
 
 // ADC macros
 #define ADC_HV          4
@@ -64,33 +153,67 @@
 #define HV_R6           268000UL        // in ohm
 #define HV_R7           3240UL          // in ohm
 #define HV_FROM_ADC(n)  ({uint32_t _r = ADC_MV(n)*(HV_R6+HV_R7)/HV_R7/1000; _r;})
+#define HV_TO_ADC(v)    ((uint32_t)(v)*1000*HV_R7/(HV_R6+HV_R7)*ADC_BITS/ADV_VREF)
+
+// a mux slot is MUX_SLOT timer ticks, the anode is lit for up to
+// MUX_OCR_MAX of them. The first MUX_BLANK ticks blank the digit change;
+// with ADC_SYNC the ADC samples in that gap, 1.5 ADC clocks (24us at
+// ADC_PRE128) plus up to one ADC clock of start-up jitter into the slot.
+// A tick is 256 cycles: a Timer0 overflow at clk/1, or a count at clk/256
+// with MUX_HWPWM, where compare A ends the slot (CTC, a power of 2 for
+// trace_time()) and compare B switches the anode.
+#define MUX_SLOT        128
+#if ADC_SYNC == 1
+#define MUX_BLANK       2
+#else
+#define MUX_BLANK       1
+#endif
+#define MUX_OCR_MAX     (MUX_SLOT - MUX_BLANK)
+
+#if MUX_HWPWM == 1
+#define MUX_vect        TIMER0_COMPA_vect
+#define MUX_IE          OCIE0A
+#define MUX_IF          OCF0A
+#define MUX_CS          _BV(CS02)
+#define MUX_FREQ        (F_CPU/256/MUX_SLOT) // mux IRQ rate in Hz, once a slot
+#else
+#define MUX_vect        TIMER0_OVF_vect
+#define MUX_IE          TOIE0
+#define MUX_IF          TOV0
+#define MUX_CS          _BV(CS00)
+#define MUX_FREQ        (F_CPU/256)     // mux IRQ rate in Hz, once a tick
+#endif
 
-#define DMUX_START()    (TCCR0 |= _BV(CS00))
-#define DMUX_STOP()     (TCCR0 &= ~_BV(CS00))
-
-#define PWM_TOP         50
-
-// a structure to hold time
-typedef struct {
-	int hh;
-	int mm;
-	int ss;
-} clock_t;
+#define DMUX_START()    (TCCR0 |= MUX_CS)
+#define DMUX_STOP()     (TCCR0 &= ~MUX_CS)
 
-// a simple pad type definition
-typedef struct {
-	volatile uint8_t *port;
-	int pin;
-} pad_t;
+// brightness levels, mapped to the slot PWM through a gamma table
+#define BRI_LEVELS      32
+#define BRI_MAX         (BRI_LEVELS - 1)
+#define BRI_TRIM_MAX    50              // per tube trim range in %
 
-// a convenience macro to define a pad
-#define PAD(_port, _pin) {.port = _port, .pin = _pin}
+#define DOT_PWM_MAX     84              // dot fade, in 1/128 of the brightness
+#define DOT_PWM_STEP    3
 
-// convenience macros to set a pad state
-#define PAD_HIGH(_pad)   *((_pad)->port) |= (1 << (_pad)->pin)
-#define PAD_LOW(_pad)    *((_pad)->port) &= ~(1 << (_pad)->pin)
-#define PAD_TOGGLE(_pad) *((_pad)->port) ^= (1 << (_pad)->pin)
+// pin states in backup mode: all outputs low, pull-ups on the buttons and
+// on RXD and TXD, which float with the UART off and no cable. The DCF77
+// input is driven by the receiver, or held low by it when DCF_SCHED cut
+// its supply (a pull-up would feed it), the analog inputs have their
+// dividers and TOSC1/2 belong to the crystal.
+#define BACKUP_PORTB    0x00
+#define BACKUP_PORTC    0x00
+#define BACKUP_PORTD    (_BV(PD0) | _BV(PD1) | _BV(PD3) | _BV(PD4))
 
 #define INLINE inline
 
+// Low priority IRQ handlers mask their own IRQ and re-enable the others
+// after the time critical part, so they can't nest into themselves.
+#if IRQ_NESTING == 1
+#define IRQ_NEST_BEGIN(reg, bit) do { reg &= ~_BV(bit); sei(); } while (0)
+#define IRQ_NEST_END(reg, bit)   do { cli(); reg |= _BV(bit); } while (0)
+#else
+#define IRQ_NEST_BEGIN(reg, bit)
+#define IRQ_NEST_END(reg, bit)
+#endif
+
 #endif
@@ -0,0 +1,433 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+#include <util/atomic.h>
+#include <avr/wdt.h>
+#include "minixie.h"
+#include "power.h"
+#include "adc.h"
+#include "diag.h"
+
+// Timer1 clock while measuring the shutdown latency, 8us per count
+#define PWR_LATENCY_CS  (_BV(CS11) | _BV(CS10))
+#define PWR_LATENCY_US  (64*1000000UL/F_CPU)
+
+volatile uint8_t pwr_state = PWR_RESUME;
+pwr_event_t pwr_event;
+pwr_stats_t pwr_stats;
+volatile pwr_trip_t pwr_trip;
+
+/**
+ * @brief Check the comparator which senses the supply.
+ *
+ * @return non-zero if the supply is down
+ */
+uint8_t pwr_lost(void)
+{
+	return ACSR & _BV(ACO);
+}
+
+/**
+ * @brief Shut down on a supply failure.
+ *
+ * Called from the comparator IRQ (or with IRQs disabled). Stops the SMPS
+ * and the mux, drives the pins to their backup states and starts Timer1
+ * to measure the time until backup mode is entered.
+ */
+void pwr_fail(void)
+{
+	if (pwr_state != PWR_ON && pwr_state != PWR_RESUME)
+		return;
+
+	SMPS_OFF();
+	DMUX_STOP();
+
+	PORTB = BACKUP_PORTB;
+	PORTC = BACKUP_PORTC;
+	PORTD = BACKUP_PORTD;
+
+	rtc_snapshot(&pwr_event.stamp, NULL);
+	pwr_event.state = pwr_state;
+	pwr_event.duty = OCR1A;
+	pwr_state = PWR_FAIL;
+	DIAG_EVENT(DIAG_EV_PWR_FAIL);
+	TRACE_TRIGGER(TRACE_T_PWR);
+
+	TCCR1A = 0;
+	TCCR1B = 0;
+	TCNT1 = 0;
+	TCCR1B = PWR_LATENCY_CS;
+}
+
+/**
+ * @brief Sample the supply with the comparator powered up just for that.
+ */
+static uint8_t pwr_sample(void)
+{
+	uint8_t lost;
+
+	ACSR = _BV(ACBG);
+	_delay_us(PWR_BG_SETTLE);
+	lost = pwr_lost();
+	ACSR = _BV(ACD) | _BV(ACI);
+
+	return lost;
+}
+
+/**
+ * @brief Sleep until the next IRQ, with the BOD off where the part allows.
+ *
+ * On the picoPower parts the BOD is turned off for the sleep. BODS only
+ * holds for a few cycles, so it is set right before the sleep
+ * instruction (sei() lets one more instruction run).
+ */
+static inline void pwr_sleep(void)
+{
+#ifdef BODS
+	cli();
+	sleep_enable();
+	sleep_bod_disable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+#else
+	sleep_mode();
+#endif
+}
+
+/**
+ * @brief Run in backup mode until the supply comes back.
+ *
+ * The caller has to shut down the peripherals first. Timer1 is borrowed
+ * to count the cycles spent awake; it is left stopped, with the SMPS
+ * settings in place, on return. The comparator is left enabled with its
+ * IRQ armed.
+ */
+void pwr_backup(void)
+{
+	rtc_stamp_t start, end;
+	uint8_t div = 0;
+#if MCU_MX8 == 1
+	uint8_t prr = PRR;
+#endif
+
+	if (pwr_state == PWR_FAIL && TCCR1B == PWR_LATENCY_CS) {
+		pwr_stats.latency = TCNT1 * PWR_LATENCY_US;
+		if (pwr_stats.latency > pwr_stats.latency_max)
+			pwr_stats.latency_max = pwr_stats.latency;
+	}
+	pwr_state = PWR_BACKUP;
+
+	rtc_snapshot(&start, NULL);
+	pwr_stats.backups++;
+
+	PORTB = BACKUP_PORTB;
+	PORTC = BACKUP_PORTC;
+	PORTD = BACKUP_PORTD;
+
+	ACSR = _BV(ACD) | _BV(ACI);
+	TCCR1A = 0;
+	TCCR1B = 0;
+	TCNT1 = 0;
+#if MCU_MX8 == 1
+	// gate the clocks of the stopped peripherals; Timer1 counts the
+	// awake cycles, Timer2 is the RTC and the comparator isn't in PRR
+	PRR = _BV(PRTWI) | _BV(PRTIM0) | _BV(PRSPI) | _BV(PRUSART0) | _BV(PRADC);
+#endif
+
+	set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+
+	for (;;) {
+		rtc_settle();
+		pwr_stats.cycles += TCNT1;
+		TCCR1B = 0;
+		pwr_sleep();
+		TCNT1 = 0;
+		TCCR1B = _BV(CS10);
+		pwr_stats.wakes++;
+
+		if (++div < PWR_POLL_DIV)
+			continue;
+		div = 0;
+		pwr_stats.polls++;
+
+		if (!pwr_sample())
+			break;
+	}
+
+	pwr_stats.cycles += TCNT1;
+#if MCU_MX8 == 1
+	PRR = prr;
+#endif
+	TCCR1B = 0;
+	TCCR1A = _BV(WGM11) | _BV(COM1A1);
+	TCCR1B = _BV(WGM13) | _BV(WGM12);
+
+	// let the bandgap settle before the comparator IRQ is armed again
+	ACSR = _BV(ACBG) | _BV(ACIS1) | _BV(ACIS0);
+	_delay_us(PWR_BG_SETTLE);
+	ACSR = _BV(ACBG) | _BV(ACI) | _BV(ACIE) | _BV(ACIS1) | _BV(ACIS0);
+
+	rtc_snapshot(&end, NULL);
+	pwr_stats.seconds += end.seconds - start.seconds;
+	DIAG_EVENT(DIAG_EV_PWR_BACK);
+}
+
+/**
+ * @brief Soft-start the SMPS after a power-up or backup mode.
+ *
+ * Ramps the duty cycle up to dc and waits for the HV to settle, then
+ * starts the mux. Blocks for PWR_SS_TIMEOUT at most; the ADC has to be
+ * initialized and idle.
+ *
+ * @return 1 if the display is up, 0 if the supply failed meanwhile
+ */
+uint8_t pwr_resume(uint8_t dc)
+{
+	uint32_t start = rtc_ticks();
+	int16_t hv, prev = 0;
+	uint8_t d = PWR_SS_DC_MIN < dc ? PWR_SS_DC_MIN : dc;
+	uint8_t ok;
+
+	pwr_state = PWR_RESUME;
+	if (pwr_lost()) {
+		cli();
+		pwr_fail();
+		sei();
+		pwr_stats.aborts++;
+		return 0;
+	}
+
+	SMPS_SET_DC(d);
+	SMPS_ON();
+
+	for (;;) {
+		_delay_ms(PWR_SS_STEP_MS);
+		if (pwr_state != PWR_RESUME) {
+			pwr_stats.aborts++;
+			return 0;
+		}
+
+		uint16_t raw = adc_read(ADC_HV, NULL);
+		pwr_hv_sample(raw);
+		hv = HV_FROM_ADC(raw);
+
+		// pwr_hv_check() takes it from here
+		if (pwr_trip.tripped) {
+			break;
+		} else if (d < dc) {
+			d = (dc - d > PWR_SS_DC_STEP) ? d + PWR_SS_DC_STEP : dc;
+			SMPS_SET_DC(d);
+		} else if (hv >= PWR_HV_ON && abs(hv - prev) <= PWR_HV_SETTLED) {
+			break;
+		} else if (rtc_ticks() - start > PWR_SS_TIMEOUT) {
+			pwr_stats.timeouts++;
+			break;
+		}
+		prev = hv;
+	}
+
+	cli();
+	ok = (pwr_state == PWR_RESUME);
+	if (ok) {
+		pwr_state = PWR_ON;
+		DMUX_START();
+	}
+	sei();
+
+	if (!ok) {
+		pwr_stats.aborts++;
+		return 0;
+	}
+
+	pwr_stats.resume = (rtc_ticks() - start) * 1000 / RTC_TICKS_PER_SEC;
+	if (pwr_stats.resume > pwr_stats.resume_max)
+		pwr_stats.resume_max = pwr_stats.resume;
+
+	return 1;
+}
+
+/**
+ * @brief Check an HV sample, cut the SMPS if it is too high.
+ *
+ * Called from the ADC IRQ for every HV conversion, and with a blocking
+ * read during the soft-start.
+ */
+void pwr_hv_sample(uint16_t value)
+{
+	pwr_trip.last = value;
+
+	if (value < HV_TO_ADC(PWR_HV_TRIP) || pwr_trip.tripped)
+		return;
+
+	OCR1A = 0;
+	SMPS_OFF();
+
+	pwr_trip.tripped = 1;
+	pwr_trip.count++;
+	pwr_trip.peak = value;
+	rtc_snapshot((rtc_stamp_t *)&pwr_trip.stamp, NULL);
+
+	if (pwr_trip.backoff == 0)
+		pwr_trip.backoff = 1;
+	else if (pwr_trip.backoff < PWR_TRIP_BACKOFF_MAX)
+		pwr_trip.backoff <<= 1;
+	pwr_trip.wait = pwr_trip.backoff;
+	pwr_trip.stable = 0;
+
+	DIAG_EVENT(DIAG_EV_HV_TRIP);
+	TRACE_TRIGGER(TRACE_T_HV);
+}
+
+/**
+ * @brief Retry after an HV trip, call once a second from the main loop.
+ */
+void pwr_hv_check(uint8_t dc)
+{
+	uint8_t warn = 0, resume = 0;
+	uint8_t backoff = 0;
+	uint16_t peak = 0;
+
+	// pwr_hv_sample() may trip from the ADC IRQ meanwhile
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (!pwr_trip.tripped) {
+			if (pwr_trip.backoff && ++pwr_trip.stable >= PWR_TRIP_STABLE)
+				pwr_trip.backoff = 0;
+		} else {
+			warn = pwr_trip.wait == pwr_trip.backoff;
+			backoff = pwr_trip.backoff;
+			peak = pwr_trip.peak;
+
+			if (pwr_trip.wait) {
+				pwr_trip.wait--;
+			} else if (pwr_trip.last < HV_TO_ADC(PWR_HV_RESET)) {
+				// the ADC keeps sampling while the SMPS is off
+				pwr_trip.tripped = 0;
+				resume = 1;
+			}
+		}
+	}
+
+	if (warn)
+		log_warn("HV trip at %luV, retry in %us", HV_FROM_ADC(peak), backoff);
+
+	if (resume)
+		pwr_resume(dc);
+}
+
+/**
+ * @brief Change the SMPS PWM frequency and duty cycle.
+ *
+ * ICR1 isn't double buffered, so the timer is stopped meanwhile and
+ * restarted right below TOP, where the new OCR1A is taken over.
+ *
+ * @param[in] khz PWM frequency in kHz
+ * @param[in] dc duty cycle in %
+ */
+void pwr_set_point(uint8_t khz, uint8_t dc)
+{
+	uint8_t on = TCCR1B & _BV(CS10);
+
+	SMPS_OFF();
+	ICR1 = SMPS_PERIOD(khz);
+	SMPS_SET_DC(dc);
+	TCNT1 = ICR1 - 1;
+	if (on)
+		SMPS_ON();
+}
+
+/**
+ * Wait until the HV has settled and return it in V.
+ */
+static uint16_t tune_settle(pwr_hv_read_t read)
+{
+	uint16_t hv = 0, prev;
+
+	for (uint8_t i = 0; i < PWR_TUNE_TRIES && !pwr_trip.tripped; i++) {
+		uint32_t sum = 0;
+
+		_delay_ms(PWR_TUNE_SETTLE_MS);
+		wdt_reset();
+		for (uint8_t j = 0; j < PWR_TUNE_SAMPLES; j++)
+			sum += read();
+
+		prev = hv;
+		hv = HV_FROM_ADC(sum / PWR_TUNE_SAMPLES);
+		if (i && abs((int16_t)hv - (int16_t)prev) <= PWR_HV_SETTLED)
+			break;
+	}
+
+	return hv;
+}
+
+/**
+ * @brief Sweep the SMPS operating points, see the top of power.h.
+ *
+ * Blocks for up to half a minute with the SMPS and the mux running; the
+ * operating point is left at the last one tried, the caller sets it.
+ *
+ * @param[in] hv target HV in V
+ * @param[in] read HV reading
+ * @param[out] best the most efficient point which reaches hv
+ * @return 1 if a point was found, 0 if none or if the sweep was aborted
+ */
+uint8_t pwr_tune(uint8_t hv, pwr_hv_read_t read, pwr_point_t *best)
+{
+	best->score = 0;
+
+	for (uint8_t khz = PWR_TUNE_KHZ_MIN; khz <= PWR_TUNE_KHZ_MAX; khz += PWR_TUNE_KHZ_STEP) {
+		uint16_t v = 0;
+		uint8_t dc;
+
+		for (dc = PWR_TUNE_DC_MIN; dc <= PWR_TUNE_DC_MAX; dc += PWR_TUNE_DC_STEP) {
+			pwr_set_point(khz, dc);
+			v = tune_settle(read);
+			if (pwr_state != PWR_ON || pwr_trip.tripped) {
+				log_warn("SMPS tuning aborted at %ukHz %u%%", khz, dc);
+				return 0;
+			}
+			if (v >= hv + PWR_TUNE_MARGIN)
+				break;
+		}
+
+		if (dc > PWR_TUNE_DC_MAX) {
+			log_info("SMPS %ukHz: %uV at most", khz, v);
+			continue;
+		}
+
+		uint16_t score = (uint32_t)v * v * khz / ((uint16_t)dc * dc);
+		log_info("SMPS %ukHz: %u%% for %uV, score %u", khz, dc, v, score);
+		if (score > best->score) {
+			best->khz = khz;
+			best->dc = dc;
+			best->hv = v;
+			best->score = score;
+		}
+	}
+
+	return best->score != 0;
+}
+
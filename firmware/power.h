@@ -0,0 +1,214 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include <inttypes.h>
+#include "rtc.h"
+
+/**
+ * The supply is watched by the analog comparator. Its IRQ calls
+ * pwr_fail(), which shuts the SMPS and the mux down and drives the pins
+ * to their backup states right away, so the time from the comparator
+ * edge to the tubes going dark doesn't depend on what the main loop was
+ * doing. The main loop then only has to notice the state change and
+ * enter backup mode; the whole latency is measured with Timer1, which
+ * is free once the SMPS is off.
+ *
+ *   PWR_ON -> PWR_FAIL -> PWR_BACKUP -> PWR_RESUME -> PWR_ON
+ *                ^                          |
+ *                +--------------------------+
+ *
+ * On resume the SMPS is soft-started: the duty cycle ramps up from
+ * PWR_SS_DC_MIN so the inrush current can't brown the supply out, and
+ * the mux is only started once the HV has settled above PWR_HV_ON. A
+ * supply failure during the ramp goes straight back to backup mode.
+ *
+ * Every HV sample is checked against PWR_HV_TRIP by pwr_hv_sample(),
+ * called from the ADC IRQ, which cuts the SMPS right away on an
+ * overshoot, e.g. from a too high 'smps dc' or a failed feedback part.
+ * pwr_hv_check() soft-starts it again once the HV is back below
+ * PWR_HV_RESET and a back-off time has passed. The back-off doubles on
+ * every trip up to PWR_TRIP_BACKOFF_MAX seconds, and is cleared after
+ * PWR_TRIP_STABLE seconds without one.
+ *
+ * pwr_tune() looks for the SMPS operating point of the unit at hand: for
+ * every PWM frequency from PWR_TUNE_KHZ_MIN to PWR_TUNE_KHZ_MAX it ramps
+ * the duty cycle up until the HV settles above the target plus
+ * PWR_TUNE_MARGIN, with the tubes lit as the load. The input power isn't
+ * measured; in discontinuous mode the inductor charges to Vin*ton/L in
+ * every period, so the input power goes with dc^2/f, and hv^2*f/dc^2
+ * ranks the points by efficiency. The supply comparator and the HV trip
+ * stay armed and abort the sweep.
+ *
+ * Backup mode runs off the supercap in SLEEP_MODE_PWR_SAVE, woken once
+ * a second by the RTC. Everything but Timer2 is off: the ADC, UART, SMPS
+ * and mux are stopped, the outputs are driven low and the BOD is off, so
+ * the bandgap only runs while the comparator is enabled. On the ATmega8
+ * the BOD is disabled by fuse (BODEN unprogrammed, see minixie.fuses).
+ * On the ATmega88PA/168PA/328P it is turned off for each sleep with BODS
+ * and the clocks of the stopped peripherals are gated in PRR; the
+ * ATmega88/168 without the PA have no BODS and need BODLEVEL set to
+ * disabled (extended fuse 0x07 or 0xFF), which is also the cheapest
+ * setting on the others.
+ *
+ * The supply is checked every PWR_POLL_DIV wakes. The comparator and
+ * the bandgap are enabled just for the check and given PWR_BG_SETTLE us
+ * to settle first; its IRQ is masked meanwhile, as toggling ACD may
+ * raise it. See tools/power_model.py for the resulting current budget.
+ */
+
+#ifndef PWR_POLL_DIV
+#define PWR_POLL_DIV    2               // supply check every n seconds
+#endif
+
+#ifndef PWR_BG_SETTLE
+#define PWR_BG_SETTLE   70              // bandgap start-up time in us
+#endif
+
+#ifndef PWR_SS_DC_MIN
+#define PWR_SS_DC_MIN   10              // soft-start initial duty cycle in %
+#endif
+
+#ifndef PWR_SS_DC_STEP
+#define PWR_SS_DC_STEP  5               // soft-start duty cycle step in %
+#endif
+
+#ifndef PWR_SS_STEP_MS
+#define PWR_SS_STEP_MS  5               // time per soft-start step
+#endif
+
+#ifndef PWR_HV_ON
+#define PWR_HV_ON       150             // HV needed to start the mux, in V
+#endif
+
+#ifndef PWR_HV_SETTLED
+#define PWR_HV_SETTLED  2               // max HV change per step when settled, in V
+#endif
+
+#ifndef PWR_HV_TRIP
+#define PWR_HV_TRIP     195             // HV which cuts the SMPS, in V
+#endif
+
+#ifndef PWR_HV_RESET
+#define PWR_HV_RESET    175             // HV below which it may restart, in V
+#endif
+
+#define PWR_TRIP_BACKOFF_MAX 64         // in s
+#define PWR_TRIP_STABLE 60              // in s
+
+#ifndef PWR_TUNE_HV
+#define PWR_TUNE_HV     170             // default tuning target, in V
+#endif
+
+#define PWR_TUNE_MARGIN 5               // in V
+#define PWR_TUNE_KHZ_MIN 30
+#define PWR_TUNE_KHZ_MAX 70
+#define PWR_TUNE_KHZ_STEP 5
+#define PWR_TUNE_DC_MIN 30              // in %
+#define PWR_TUNE_DC_MAX 85              // in %
+#define PWR_TUNE_DC_STEP 5              // in %
+#define PWR_TUNE_SETTLE_MS 20           // between HV readings
+#define PWR_TUNE_TRIES  10              // readings until settled, at most
+#define PWR_TUNE_SAMPLES 8              // ADC samples per reading
+
+#ifndef PWR_SS_TIMEOUT
+#define PWR_SS_TIMEOUT  (RTC_TICKS_PER_SEC/2) // start the mux anyway after that
+#endif
+
+typedef enum {
+	PWR_ON,         /**< running off the mains supply */
+	PWR_FAIL,       /**< supply lost, shut down by the comparator IRQ */
+	PWR_BACKUP,     /**< running off the supercap */
+	PWR_RESUME,     /**< supply back, soft-starting the SMPS */
+} pwr_state_t;
+
+/**
+ * @brief Supply failure record, taken in the comparator IRQ
+ */
+typedef struct {
+	rtc_stamp_t stamp;  /**< when it happened */
+	uint8_t state;      /**< state that was interrupted */
+	uint16_t duty;      /**< SMPS compare value (OCR1A) at the time */
+} pwr_event_t;
+
+/**
+ * @brief Backup mode statistics
+ */
+typedef struct {
+	uint16_t backups;   /**< number of times backup mode was entered */
+	uint32_t seconds;   /**< total time spent in backup mode */
+	uint32_t wakes;     /**< RTC wakes in backup mode */
+	uint32_t polls;     /**< supply checks */
+	uint32_t cycles;    /**< CPU cycles spent awake, RTC IRQ excluded */
+	uint16_t latency;   /**< last comparator edge to sleep time, in us */
+	uint16_t latency_max;
+	uint16_t resume;    /**< last resume to mux start time, in ms */
+	uint16_t resume_max;
+	uint16_t timeouts;  /**< soft-starts which timed out */
+	uint16_t aborts;    /**< soft-starts aborted by a supply failure */
+} pwr_stats_t;
+
+/**
+ * @brief HV trip state
+ */
+typedef struct {
+	uint8_t tripped;    /**< set while the SMPS is cut */
+	uint8_t backoff;    /**< current back-off in s */
+	uint8_t wait;       /**< seconds left until the retry */
+	uint16_t stable;    /**< seconds since the last retry */
+	uint16_t count;     /**< number of trips */
+	uint16_t peak;      /**< ADC reading which caused the last trip */
+	uint16_t last;      /**< last HV ADC reading */
+	rtc_stamp_t stamp;  /**< time of the last trip */
+} pwr_trip_t;
+
+/**
+ * @brief SMPS operating point, see pwr_tune()
+ */
+typedef struct {
+	uint8_t khz;        /**< PWM frequency in kHz */
+	uint8_t dc;         /**< duty cycle in % */
+	uint16_t hv;        /**< HV reached, in V */
+	uint16_t score;     /**< relative efficiency, hv^2*f/dc^2 */
+} pwr_point_t;
+
+/**
+ * @brief HV reading for pwr_tune(), an ADC value already checked by
+ * pwr_hv_sample()
+ */
+typedef uint16_t (*pwr_hv_read_t)(void);
+
+extern volatile uint8_t pwr_state;
+extern volatile pwr_trip_t pwr_trip;
+extern pwr_event_t pwr_event;
+extern pwr_stats_t pwr_stats;
+
+uint8_t pwr_lost(void);
+void pwr_fail(void);
+void pwr_backup(void);
+uint8_t pwr_resume(uint8_t dc);
+void pwr_hv_sample(uint16_t value);
+void pwr_hv_check(uint8_t dc);
+void pwr_set_point(uint8_t khz, uint8_t dc);
+uint8_t pwr_tune(uint8_t hv, pwr_hv_read_t read, pwr_point_t *best);
+
+#endif
@@ -0,0 +1,183 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include "frame.h"
+#include "diag.h"
+#include "prof.h"
+
+#if PROF == 1
+
+volatile prof_t prof;
+static uint16_t prof_bins[PROF_BINS];
+static uint16_t prof_pc;
+
+// sample the interrupted PC, then count it
+ISR(TIMER2_COMP_vect, ISR_NAKED)
+{
+	DIAG_SAMPLE_PC_TO(&prof_pc);
+	asm volatile ("%~jmp __vector_prof_sample");
+}
+
+ISR(__vector_prof_sample)
+{
+	uint16_t offset = prof_pc - prof.lo;
+	uint8_t lfsr = prof.lfsr;
+
+	// step - mask/2 plus 0..mask ticks
+	lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xB8);
+	prof.lfsr = lfsr;
+	rtc_compare_in(prof.step - (prof.mask >> 1) + (lfsr & prof.mask));
+
+	if ((offset >> prof.shift) < PROF_BINS)
+		prof_bins[offset >> prof.shift]++;
+	else
+		prof.other++;
+
+	if (++prof.samples == UINT16_MAX) {
+		prof.running = 0;
+		rtc_compare_irq(0);
+	}
+}
+
+static void clear(void)
+{
+	memset(prof_bins, 0, sizeof(prof_bins));
+	prof.samples = 0;
+	prof.other = 0;
+}
+
+/**
+ * @brief Clear the bins and start sampling.
+ *
+ * Must not be called from IRQ context.
+ *
+ * @param[in] step mean interval in RTC ticks, at least PROF_STEP_MIN
+ */
+void prof_start(uint8_t step)
+{
+	if (step < PROF_STEP_MIN)
+		step = PROF_STEP_MIN;
+
+	prof_stop();
+	if (!prof.shift)
+		prof_range(prof.lo, 0);
+
+	clear();
+	prof.step = step;
+	// the largest power of 2 up to step, less one
+	prof.mask = 1;
+	while (prof.mask <= step >> 1)
+		prof.mask <<= 1;
+	prof.mask--;
+	if (!prof.lfsr)
+		prof.lfsr = 0x5A;
+
+	prof.running = 1;
+	while (!rtc_compare_in(step))
+		;
+	rtc_compare_irq(1);
+}
+
+/**
+ * @brief Stop sampling, the bins are kept.
+ */
+void prof_stop(void)
+{
+	rtc_compare_irq(0);
+	prof.running = 0;
+}
+
+/**
+ * @brief Set the range of the bins and clear them.
+ *
+ * @param[in] lo first word address
+ * @param[in] shift log2 of the bin width in words, 0 to cover the flash
+ *            from lo to its end
+ */
+void prof_range(uint16_t lo, uint8_t shift)
+{
+	uint8_t running = prof.running;
+
+	prof_stop();
+	if (!shift)
+		while (shift < 15 && ((uint32_t)PROF_BINS << shift) < (FLASHEND + 1UL) / 2 - lo)
+			shift++;
+
+	prof.lo = lo;
+	prof.shift = shift;
+	clear();
+	if (running)
+		prof_start(prof.step);
+}
+
+/**
+ * Queue a frame, waiting for room in the TX queue.
+ */
+static void send(const void *payload, uint8_t len)
+{
+	while (!frame_write(FRAME_PROF, payload, len))
+		wdt_reset();
+}
+
+/**
+ * @brief Dump the bins as FRAME_PROF frames, see prof_hdr_t.
+ *
+ * Sampling goes on. Must not be called from IRQ context.
+ */
+void prof_dump(void)
+{
+	uint8_t frame[1 + PROF_PER_FRAME * 2];
+	prof_hdr_t hdr;
+	uint8_t n = 0;
+
+	hdr.seq = 0;
+	hdr.bins = PROF_BINS;
+	hdr.shift = prof.shift;
+	hdr.step = prof.step;
+	hdr.lo = prof.lo;
+
+	cli();
+	hdr.samples = prof.samples;
+	hdr.other = prof.other;
+	sei();
+	send(&hdr, sizeof(hdr));
+
+	frame[0] = 1;
+	for (uint8_t i = 0; i < PROF_BINS; i++) {
+		uint16_t count;
+
+		cli();
+		count = prof_bins[i];
+		sei();
+		memcpy(frame + 1 + n * 2, &count, 2);
+		if (++n == PROF_PER_FRAME || i == PROF_BINS - 1) {
+			send(frame, 1 + n * 2);
+			frame[0]++;
+			n = 0;
+		}
+	}
+}
+
+#endif
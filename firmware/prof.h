@@ -0,0 +1,107 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _PROF_H_
+#define _PROF_H_
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include "rtc.h"
+#include "frame.h"
+
+/**
+ * Statistical profiler: the Timer2 compare IRQ samples the interrupted
+ * PC every `step` RTC ticks on average and counts it in one of PROF_BINS
+ * bins, each covering 2^shift words of flash from `lo` on. Samples
+ * outside go to `other`. By default the bins cover the whole flash; a
+ * narrower range zooms into a hot spot. Samples taken in sleep show up
+ * at the sleep instruction, those taken in an ISR which enabled IRQs in
+ * that ISR.
+ *
+ * The main loop runs in step with the RTC, so the sampling interval is
+ * dithered to keep the samples from locking to its phase. Sampling stops
+ * after 65535 samples, when no bin can overflow, and when the supply
+ * fails. `prof d` dumps the bins as FRAME_PROF frames for
+ * tools/prof_map.py, which maps them to functions.
+ *
+ * Build with PROF=1. It takes the compare unit RTC_PPS=1 uses.
+ */
+
+#ifndef PROF
+#define PROF            0
+#endif
+
+#if PROF == 1 && RTC_PPS == 1
+#error "PROF and RTC_PPS both need the Timer2 compare unit"
+#endif
+
+// histogram bins, 2 bytes of RAM each
+#ifndef PROF_BINS
+#if MCU_BIG_RAM == 1
+#define PROF_BINS       64
+#else
+#define PROF_BINS       32
+#endif
+#endif
+
+// sampling interval in RTC ticks
+#define PROF_STEP_MIN   4               // 64Hz
+#define PROF_STEP_DEF   8               // 32Hz
+
+#define PROF_PER_FRAME  ((FRAME_MAX_LEN - 1) / 2)
+
+/**
+ * @brief Profiler state
+ */
+typedef struct {
+	uint16_t lo;        /**< first word address of bin 0 */
+	uint8_t shift;      /**< bins are 2^shift words wide */
+	uint8_t step;       /**< mean sampling interval in ticks */
+	uint8_t mask;       /**< dither of the interval */
+	uint8_t lfsr;
+	uint8_t running;
+	uint16_t samples;
+	uint16_t other;     /**< samples outside the bins */
+} prof_t;
+
+/**
+ * @brief Dump header, the first FRAME_PROF frame
+ *
+ * The bins follow in frames of a seq byte (1, 2, ...) and up to
+ * PROF_PER_FRAME uint16_t counts.
+ */
+typedef struct {
+	uint8_t seq;        /**< 0 */
+	uint8_t bins;
+	uint8_t shift;
+	uint8_t step;
+	uint16_t lo;
+	uint16_t samples;
+	uint16_t other;
+} prof_hdr_t;
+
+extern volatile prof_t prof;
+
+void prof_start(uint8_t step);
+void prof_stop(void);
+void prof_range(uint16_t lo, uint8_t shift);
+void prof_dump(void);
+
+#endif
@@ -59,5 +59,6 @@ static inline int q_get(queue_t *q, uint8_t *result)
 }
 
 #define q_is_empty(q) (q->length == 0)
+#define q_free(q)     (q->size - 1 - q->length)
 
 #endif
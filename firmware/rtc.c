@@ -0,0 +1,585 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "rtc.h"
+#include "gpio.h"
+#include "diag.h"
+#include "trace.h"
+
+#define SECONDS_PER_DAY     86400L
+
+static volatile struct {
+	rtc_cb_t cb;
+	uint32_t base;      // raw ticks at the last overflow
+	uint32_t seconds;
+	clock_t time;
+	int16_t trim;
+	int32_t acc;        // trim accumulator, in RTC_TRIM_TICK units
+	int16_t slew;       // ticks still to be slewed, see rtc_correct()
+	uint8_t stretch;    // set while the extra tick of a stretched second runs
+	uint8_t mark;       // lengthen the next PPS pulse, see RTC_PPS_MARK
+} rtc_ctx;
+
+rtc_drift_t rtc_drift;
+
+/**
+ * Advance a wall clock by one second.
+ */
+static inline void clock_inc(volatile clock_t *t)
+{
+	if (t->ss < 59) {
+		t->ss++;
+		return;
+	}
+	t->ss = 0;
+
+	if (t->mm < 59) {
+		t->mm++;
+		return;
+	}
+	t->mm = 0;
+
+	if (t->hh < 23) {
+		t->hh++;
+		return;
+	}
+	t->hh = 0;
+}
+
+static int32_t clock_to_sod(const volatile clock_t *t)
+{
+	return (int32_t)t->hh * 3600 + t->mm * 60 + t->ss;
+}
+
+static void clock_from_sod(volatile clock_t *t, int32_t sod)
+{
+	sod %= SECONDS_PER_DAY;
+	if (sod < 0)
+		sod += SECONDS_PER_DAY;
+
+	t->hh = sod / 3600;
+	t->mm = (sod / 60) % 60;
+	t->ss = sod % 60;
+}
+
+/**
+ * Write TCNT2 obeying the asynchronous update rules. Returns once the
+ * new value has reached the counter. Must be called with IRQs disabled.
+ */
+static inline void write_tcnt2(uint8_t value)
+{
+	while (ASSR & _BV(TCN2UB))
+		;
+	TCNT2 = value;
+	while (ASSR & _BV(TCN2UB))
+		;
+}
+
+/**
+ * Apply the fractional frequency correction. Called at the start of each
+ * second, when TCNT2 has just wrapped to 0. Whenever the accumulated
+ * correction reaches a full tick the second is shortened by skipping a
+ * tick or lengthened by one extra tick. Raw ticks stay continuous.
+ *
+ * A pending slew moves the clock by one tick per second the same way, in
+ * the seconds the trim leaves alone.
+ */
+static inline void trim_step(void)
+{
+	int8_t step = 0;
+
+	rtc_ctx.acc += rtc_ctx.trim;
+
+	if (rtc_ctx.acc >= RTC_TRIM_TICK) {
+		rtc_ctx.acc -= RTC_TRIM_TICK;
+		step = 1;
+	} else if (rtc_ctx.acc <= -RTC_TRIM_TICK) {
+		rtc_ctx.acc += RTC_TRIM_TICK;
+		step = -1;
+	} else if (rtc_ctx.slew > 0) {
+		rtc_ctx.slew--;
+		step = 1;
+	} else if (rtc_ctx.slew < 0) {
+		rtc_ctx.slew++;
+		step = -1;
+	}
+
+	if (step > 0) {
+		write_tcnt2(1);
+		rtc_ctx.base -= 1;
+	} else if (step < 0) {
+		write_tcnt2(RTC_TICKS_PER_SEC - 1);
+		rtc_ctx.base -= RTC_TICKS_PER_SEC - 1;
+		rtc_ctx.stretch = 1;
+	}
+}
+
+// RTC clock timer - IRQ invoked once a second
+#if DIAG_PC == 1 || RTC_PPS == 1
+// raise the PPS output (a single sbi, which leaves SREG and the registers
+// alone) and sample the interrupted PC for diag.c, then run the actual
+// handler. The PPS pin stays high through the extra overflow of a
+// stretched second.
+ISR(TIMER2_OVF_vect, ISR_NAKED)
+{
+#if RTC_PPS == 1
+	GPIO_HIGH(PIN_PPS);
+#endif
+#if DIAG_PC == 1
+	DIAG_SAMPLE_PC();
+#endif
+	asm volatile ("%~jmp __vector_rtc_overflow");
+}
+#define RTC_OVF_vect __vector_rtc_overflow
+#else
+#define RTC_OVF_vect TIMER2_OVF_vect
+#endif
+
+ISR(RTC_OVF_vect)
+{
+	TRACE_EVENT(TRACE_IRQ_IN, TRACE_V_TIMER2_OVF);
+	rtc_ctx.base += RTC_TICKS_PER_SEC;
+
+	// the extra overflow of a stretched second doesn't start a new one
+	if (rtc_ctx.stretch) {
+		rtc_ctx.stretch = 0;
+	} else {
+#if RTC_PPS == 1 && RTC_PPS_MARK == 1
+		// OCR2 was last written a second ago, it can't be busy
+		if (rtc_ctx.mark) {
+			rtc_ctx.mark = 0;
+			OCR2 = RTC_PPS_MARK_WIDTH;
+		}
+#endif
+		rtc_ctx.seconds++;
+		clock_inc(&rtc_ctx.time);
+		trim_step();
+
+		if (rtc_ctx.cb != NULL)
+			rtc_ctx.cb();
+	}
+	TRACE_EVENT(TRACE_IRQ_OUT, TRACE_V_TIMER2_OVF);
+}
+
+#if RTC_PPS == 1
+// end of the PPS pulse
+ISR(TIMER2_COMP_vect)
+{
+	TRACE_EVENT(TRACE_IRQ_IN, TRACE_V_TIMER2_COMP);
+	GPIO_LOW(PIN_PPS);
+#if RTC_PPS_MARK == 1
+	OCR2 = RTC_PPS_WIDTH;
+#endif
+	TRACE_EVENT(TRACE_IRQ_OUT, TRACE_V_TIMER2_COMP);
+}
+#endif
+
+/**
+ * @brief Initialize the RTC.
+ *
+ * Follows the datasheet procedure for switching Timer2 to asynchronous
+ * operation: the timer registers may be corrupted while AS2 changes, so
+ * they are written only afterwards and the IRQs are enabled once the
+ * update busy flags have cleared.
+ *
+ * @param[in] cb a pointer to a function called once a second from IRQ context
+ */
+void rtc_init(rtc_cb_t cb)
+{
+	rtc_ctx.cb = cb;
+
+	TIMSK2 &= ~(_BV(TOIE2) | _BV(OCIE2));
+	ASSR = _BV(AS2);
+	TCNT2 = 0;
+#if RTC_PPS == 1
+	OCR2 = RTC_PPS_WIDTH;
+	GPIO_LOW(PIN_PPS);
+	GPIO_OUTPUT(PIN_PPS);
+#endif
+	// clock div 128, normal mode
+	TCCR2 = _BV(CS22) | _BV(CS20);
+	while (ASSR & (_BV(TCN2UB) | _BV(OCR2UB) | _BV(TCR2UB)))
+		;
+	TIFR2 = _BV(TOV2) | _BV(OCF2);
+	// generate an IRQ on timer overflow (and on the end of the PPS pulse)
+	TIMSK2 |= _BV(TOIE2);
+#if RTC_PPS == 1
+	TIMSK2 |= _BV(OCIE2);
+#endif
+}
+
+/**
+ * @brief Wait until the asynchronous timer has caught up with the CPU.
+ *
+ * Must be called before entering power-save after a Timer2 wake-up (the
+ * IRQ logic needs one TOSC1 cycle to reset) and before reading TCNT2
+ * after waking up from power-save (it may still hold the old value).
+ */
+void rtc_settle(void)
+{
+	TCCR2 = TCCR2;
+	while (ASSR & _BV(TCR2UB))
+		;
+}
+
+/**
+ * Read TCNT2 and tell if an overflow is pending, i.e. it happened but the
+ * IRQ has not run yet. Must be called with IRQs disabled.
+ */
+static inline uint8_t read_subticks(uint8_t *pending)
+{
+	uint8_t sub;
+
+	// TCNT2 is synchronized from the TOSC1 domain; read it until it is
+	// stable. The TOV2 flag lags the counter by a few cycles, reading it
+	// after the confirmation read covers that.
+	do {
+		sub = TCNT2;
+	} while (sub != TCNT2);
+
+	*pending = (TIFR2 & _BV(TOV2)) && sub < RTC_TICKS_PER_SEC / 2;
+	return sub;
+}
+
+#if RTC_PPS == 0
+/**
+ * @brief Enable the Timer2 compare IRQ.
+ *
+ * The compare unit is free unless RTC_PPS=1; its user provides
+ * TIMER2_COMP_vect (see prof.c) and arms it with rtc_compare_in().
+ *
+ * @param[in] on 1 to enable, 0 to disable
+ */
+void rtc_compare_irq(uint8_t on)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (on) {
+			TIFR2 = _BV(OCF2);
+			TIMSK2 |= _BV(OCIE2);
+		} else {
+			TIMSK2 &= ~_BV(OCIE2);
+		}
+	}
+}
+
+/**
+ * @brief Set the compare match a number of ticks from now.
+ *
+ * OCR2 takes two crystal cycles to reach the timer, so less than 2 ticks
+ * may miss the match and wait for the counter to wrap. So does a match
+ * jumped over by a trim step or rtc_adjust(). Safe in IRQ context.
+ *
+ * @param[in] ticks 1/256s ticks from now
+ * @return 0 if OCR2 is still busy with the last write
+ */
+uint8_t rtc_compare_in(uint8_t ticks)
+{
+	uint8_t sub, pending;
+
+	if (ASSR & _BV(OCR2UB))
+		return 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		sub = read_subticks(&pending);
+		OCR2 = sub + ticks;
+	}
+
+	return 1;
+}
+#endif
+
+/**
+ * @brief Get the monotonic tick count.
+ *
+ * Counts raw crystal ticks, i.e. it is not affected by trimming nor by
+ * rtc_adjust(). Safe to call from IRQ context.
+ *
+ * @return number of 1/256s ticks since rtc_init()
+ */
+uint32_t rtc_ticks(void)
+{
+	uint32_t ticks;
+	uint8_t pending;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ticks = rtc_ctx.base + read_subticks(&pending);
+		if (pending)
+			ticks += RTC_TICKS_PER_SEC;
+	}
+
+	return ticks;
+}
+
+/**
+ * @brief Take a consistent snapshot of the disciplined and wall clock time.
+ *
+ * The stamp seconds follow every rtc_adjust(), use rtc_ticks() to measure
+ * intervals. Safe to call from IRQ context.
+ *
+ * @param[out] stamp disciplined time stamp, may be NULL
+ * @param[out] time wall clock time, may be NULL
+ */
+void rtc_snapshot(rtc_stamp_t *stamp, clock_t *time)
+{
+	uint8_t pending;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint8_t sub = read_subticks(&pending);
+
+		// the extra tick of a stretched second belongs to the next one
+		if (rtc_ctx.stretch) {
+			sub = 0;
+			pending = 0;
+		}
+
+		if (stamp != NULL) {
+			stamp->seconds = rtc_ctx.seconds + pending;
+			stamp->subticks = sub;
+		}
+
+		if (time != NULL) {
+			*time = rtc_ctx.time;
+			if (pending)
+				clock_inc(time);
+		}
+	}
+}
+
+/**
+ * @brief Get the wall clock time.
+ */
+void rtc_get_time(clock_t *time)
+{
+	rtc_snapshot(NULL, time);
+}
+
+/**
+ * @brief Set the wall clock time.
+ *
+ * The sub-second phase is not changed. Since the clock is moved by an
+ * unknown amount the drift estimation starts over. Must not be called
+ * from IRQ context.
+ */
+void rtc_set_time(const clock_t *time)
+{
+	uint8_t pending = 1;
+
+	// an overflow which is pending would advance the new time, so let
+	// the IRQ run first
+	while (pending) {
+		ATOMIC_BLOCK(ATOMIC_FORCEON) {
+			read_subticks(&pending);
+			if (!pending) {
+				rtc_ctx.time = *time;
+				rtc_ctx.slew = 0;
+			}
+		}
+	}
+
+	rtc_drift.valid = 0;
+}
+
+/**
+ * @brief Set the frequency trim.
+ *
+ * @param[in] trim correction in 10ppb units, positive if the crystal is slow
+ */
+void rtc_set_trim(int16_t trim)
+{
+	if (trim > RTC_TRIM_MAX)
+		trim = RTC_TRIM_MAX;
+	else if (trim < -RTC_TRIM_MAX)
+		trim = -RTC_TRIM_MAX;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		rtc_ctx.trim = trim;
+	}
+}
+
+/**
+ * @brief Get the frequency trim in 10ppb units.
+ */
+int16_t rtc_get_trim(void)
+{
+	return rtc_ctx.trim;
+}
+
+/**
+ * @brief Step the disciplined clock.
+ *
+ * Moves the wall clock and the sub-second phase by a number of ticks.
+ * Must not be called from IRQ context; it may wait up to one tick.
+ *
+ * @param[in] ticks number of 1/256s ticks, positive moves the clock forward
+ */
+void rtc_adjust(int32_t ticks)
+{
+	int32_t seconds = ticks / RTC_TICKS_PER_SEC;
+	int16_t frac = ticks % RTC_TICKS_PER_SEC;
+	uint8_t done = 0;
+
+	while (!done) {
+		// start right after a tick edge so that the new value reaches
+		// the counter well before the next one
+		uint8_t sub = TCNT2;
+		while (TCNT2 == sub)
+			;
+
+		ATOMIC_BLOCK(ATOMIC_FORCEON) {
+			uint8_t pending;
+			sub = read_subticks(&pending);
+
+			// stay clear of the overflow
+			if (!pending && !rtc_ctx.stretch && sub != RTC_TICKS_PER_SEC - 1) {
+				int16_t n = sub + frac;
+				int32_t s = seconds;
+
+				if (n >= RTC_TICKS_PER_SEC) {
+					n -= RTC_TICKS_PER_SEC;
+					s++;
+				} else if (n < 0) {
+					n += RTC_TICKS_PER_SEC;
+					s--;
+				}
+
+				write_tcnt2(n);
+#if RTC_PPS == 1
+				// the compare is skipped if the counter jumps over it
+				if (n >= RTC_PPS_WIDTH)
+					GPIO_LOW(PIN_PPS);
+#endif
+				rtc_ctx.base -= n - sub;
+				rtc_ctx.seconds += s;
+				clock_from_sod(&rtc_ctx.time, clock_to_sod(&rtc_ctx.time) + s);
+				done = 1;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Lock the clock to a reference and estimate the crystal drift.
+ *
+ * The clock is stepped to the reference, see rtc_correct().
+ *
+ * @param[in] mark disciplined time stamp of the reference event
+ * @param[in] ref reference wall clock time at the mark
+ * @param[in] ref_subticks sub-second part of the reference time
+ * @return 1 if the trim has been updated, 0 otherwise
+ */
+uint8_t rtc_discipline(const rtc_stamp_t *mark, const clock_t *ref, uint8_t ref_subticks)
+{
+	const int32_t day = SECONDS_PER_DAY * RTC_TICKS_PER_SEC;
+	rtc_stamp_t now;
+	clock_t t;
+	int32_t offset;
+
+	rtc_snapshot(&now, &t);
+
+	// local time at the mark minus the reference time
+	offset = (clock_to_sod(&t) - (int32_t)(now.seconds - mark->seconds)) * RTC_TICKS_PER_SEC;
+	offset += mark->subticks;
+	offset -= clock_to_sod(ref) * RTC_TICKS_PER_SEC + ref_subticks;
+
+	if (offset > day / 2)
+		offset -= day;
+	else if (offset < -day / 2)
+		offset += day;
+
+	return rtc_correct(mark, offset, 0);
+}
+
+/**
+ * @brief Correct a measured offset and estimate the crystal drift.
+ *
+ * The clock is stepped by the offset or, if asked to and the offset is
+ * at most RTC_SLEW_MAX ticks, slewed one tick per second. The offsets are
+ * accumulated and, once they span at least RTC_DRIFT_SPAN seconds, turned
+ * into a frequency error which is folded into the trim. An offset above
+ * RTC_STEP_MAX (the first sync or a bad reference) restarts the
+ * estimation. Must not be called from IRQ context.
+ *
+ * @param[in] mark disciplined time stamp of the measurement
+ * @param[in] offset local minus reference time in ticks
+ * @param[in] slew slew small offsets instead of stepping
+ * @return 1 if the trim has been updated, 0 otherwise
+ */
+uint8_t rtc_correct(const rtc_stamp_t *mark, int32_t offset, uint8_t slew)
+{
+	uint32_t span;
+	int16_t pending;
+
+	rtc_drift.offset = offset;
+	rtc_drift.syncs++;
+	rtc_ctx.mark = 1;
+
+	if (slew && labs(offset) <= RTC_SLEW_MAX) {
+		// a new measurement replaces what is left of the last one
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			pending = rtc_ctx.slew;
+			rtc_ctx.slew = -offset;
+		}
+	} else {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			pending = rtc_ctx.slew;
+			rtc_ctx.slew = 0;
+		}
+		if (offset != 0)
+			rtc_adjust(-offset);
+	}
+
+	if (!rtc_drift.valid || labs(offset) > RTC_STEP_MAX) {
+		rtc_drift.anchor = mark->seconds;
+		rtc_drift.sum = 0;
+		rtc_drift.valid = 1;
+		return 0;
+	}
+
+	// the part of the last offset which wasn't slewed out yet is measured
+	// again, it has already been counted
+	rtc_drift.sum += offset + pending;
+	span = mark->seconds - rtc_drift.anchor;
+
+	if (span < RTC_DRIFT_SPAN)
+		return 0;
+
+	if (labs(rtc_drift.sum) < INT32_MAX / RTC_TRIM_TICK) {
+		int32_t trim = rtc_ctx.trim - rtc_drift.sum * RTC_TRIM_TICK / (int32_t)span;
+
+		if (trim > RTC_TRIM_MAX)
+			trim = RTC_TRIM_MAX;
+		else if (trim < -RTC_TRIM_MAX)
+			trim = -RTC_TRIM_MAX;
+
+		rtc_set_trim(trim);
+	}
+
+	rtc_drift.anchor = mark->seconds;
+	rtc_drift.sum = 0;
+	rtc_drift.estimates++;
+
+	return 1;
+}
@@ -0,0 +1,153 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _RTC_H_
+#define _RTC_H_
+
+#include <inttypes.h>
+#include "mcu.h"
+
+/**
+ * The RTC runs off Timer2 clocked asynchronously from the 32.768kHz
+ * crystal (div 128), so TCNT2 counts 1/256s sub-ticks and overflows once
+ * a second. This module owns Timer2; everything else uses the API below
+ * instead of touching TCNT2 or the IRQ-updated variables directly.
+ *
+ * Two time scales are provided:
+ * - rtc_ticks() counts raw crystal ticks. It is never adjusted, which
+ *   makes it the right choice for measuring intervals.
+ * - rtc_snapshot() returns the disciplined time: seconds and sub-ticks
+ *   of the wall clock, which is trimmed for crystal drift and phase
+ *   locked to a reference by rtc_discipline().
+ */
+
+#define RTC_TICKS_PER_SEC   256
+
+// trim is given in units of 10ppb, one tick is 1/256s = 390625 units
+#define RTC_TRIM_TICK       390625L
+#define RTC_TRIM_MAX        20000           // +/-200ppm
+
+// offsets larger than that step the clock and restart drift estimation
+#ifndef RTC_STEP_MAX
+#define RTC_STEP_MAX        (2*RTC_TICKS_PER_SEC)
+#endif
+
+// offsets up to that may be slewed instead of stepped, see rtc_correct()
+#ifndef RTC_SLEW_MAX
+#define RTC_SLEW_MAX        16
+#endif
+
+// minimum time between drift estimates, in seconds
+#ifndef RTC_DRIFT_SPAN
+#define RTC_DRIFT_SPAN      14400UL
+#endif
+
+/**
+ * With RTC_PPS=1 PIN_PPS puts out a pulse at the start of every second
+ * of the disciplined clock, for measuring its accuracy and holdover with
+ * a logic analyzer (or a simulated capture, see tools/chainsim).
+ *
+ * The rising edge is set by the first instruction of the Timer2 overflow
+ * IRQ: 8 CPU cycles (1us) after the overflow, the IRQ response and the
+ * vector jump, plus the time IRQs are disabled at that moment and a few
+ * cycles of wake-up from sleep. The falling edge comes from the compare
+ * IRQ RTC_PPS_WIDTH ticks later. A stretched second's pulse is one tick
+ * longer. With RTC_PPS_MARK=1 the pulse after an rtc_correct() is
+ * RTC_PPS_MARK_WIDTH ticks long, marking every DCF77 (or chain, host)
+ * correction on the same channel.
+ *
+ * PB0 is not routed to the aux connector (its GPIO is the DCF77 input)
+ * and it is the receiver supply of DCF_SCHED=1 builds, one of them has
+ * to be moved. The pulses go on in backup mode, at the cost of a compare
+ * wake-up a second.
+ */
+#ifndef RTC_PPS
+#define RTC_PPS             0
+#endif
+
+#ifndef PIN_PPS
+#define PIN_PPS             B, 0
+#endif
+
+#ifndef RTC_PPS_MARK
+#define RTC_PPS_MARK        1
+#endif
+
+// in ticks, at least 2 so that a skipped tick can't jump over the compare
+#define RTC_PPS_WIDTH       4               // 15.6ms
+#define RTC_PPS_MARK_WIDTH  64              // 250ms
+
+// a structure to hold time
+typedef struct {
+	int hh;
+	int mm;
+	int ss;
+} clock_t;
+
+/**
+ * @brief Monotonic time stamp
+ */
+typedef struct {
+	uint32_t seconds;   /**< seconds since rtc_init() */
+	uint8_t subticks;   /**< 1/256s fraction of the current second */
+} rtc_stamp_t;
+
+/**
+ * @brief Drift estimator state, see rtc_discipline()
+ */
+typedef struct {
+	int32_t offset;     /**< last measured offset in ticks, positive if the clock was ahead */
+	int32_t sum;        /**< offset accumulated since the anchor */
+	uint32_t anchor;    /**< start of the current estimation span, in seconds */
+	uint16_t syncs;     /**< number of rtc_correct() calls */
+	uint16_t estimates; /**< number of trim updates */
+	uint8_t valid;      /**< set if anchor is valid */
+} rtc_drift_t;
+
+/**
+ * @brief RTC tick callback.
+ *
+ * The callback is called from Timer2 IRQ context once a second, after
+ * the wall clock has been advanced.
+ */
+typedef void (*rtc_cb_t)(void);
+
+extern rtc_drift_t rtc_drift;
+
+void rtc_init(rtc_cb_t cb);
+void rtc_settle(void);
+
+uint32_t rtc_ticks(void);
+void rtc_snapshot(rtc_stamp_t *stamp, clock_t *time);
+void rtc_get_time(clock_t *time);
+void rtc_set_time(const clock_t *time);
+
+void rtc_set_trim(int16_t trim);
+int16_t rtc_get_trim(void);
+void rtc_adjust(int32_t ticks);
+uint8_t rtc_discipline(const rtc_stamp_t *mark, const clock_t *ref, uint8_t ref_subticks);
+uint8_t rtc_correct(const rtc_stamp_t *mark, int32_t offset, uint8_t slew);
+
+#if RTC_PPS == 0
+void rtc_compare_irq(uint8_t on);
+uint8_t rtc_compare_in(uint8_t ticks);
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "frame.h"
+#include "telemetry.h"
+
+volatile uint16_t tlm_div = 0;
+volatile uint16_t tlm_cnt = 0;
+
+static uint16_t tlm_seq = 0;
+static uint16_t tlm_drops = 0;
+
+/**
+ * @brief Set telemetry sample rate.
+ *
+ * @param[in] hz sample rate in Hz (clipped to TLM_RATE_MAX), 0 stops streaming
+ */
+void tlm_set_rate(uint16_t hz)
+{
+	if (hz > TLM_RATE_MAX)
+		hz = TLM_RATE_MAX;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		tlm_div = hz ? MUX_FREQ / hz : 0;
+		tlm_cnt = 0;
+	}
+}
+
+/**
+ * @brief Get telemetry sample rate in Hz, 0 if streaming is off.
+ */
+uint16_t tlm_rate(void)
+{
+	uint16_t div;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		div = tlm_div;
+	}
+	return div ? MUX_FREQ / div : 0;
+}
+
+/**
+ * @brief Stamp a sample with a sequence number and send it.
+ */
+void tlm_send(tlm_sample_t *sample)
+{
+	sample->seq = tlm_seq++;
+	sample->drops = tlm_drops;
+
+	if (!frame_write(FRAME_TLM, sample, sizeof(*sample)))
+		tlm_drops++;
+}
@@ -0,0 +1,101 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <inttypes.h>
+#include <util/atomic.h>
+#include "minixie.h"
+
+/**
+ * Telemetry streams fixed-layout samples as FRAME_TLM frames. A frame
+ * takes sizeof(tlm_sample_t) + FRAME_OVERHEAD = 21 bytes on the wire,
+ * so the sustainable rate is UART_BAUD_RATE/210 Hz: ~90Hz at 19200,
+ * ~180Hz at 38400 and ~1190Hz at 250000 (which is exact at 8MHz).
+ * Samples which don't fit in the TX queue are dropped but still consume
+ * a sequence number so the host can detect the loss.
+ */
+
+// in Hz, at most one sample per mux IRQ
+#ifndef TLM_RATE_MAX
+#if MUX_FREQ < 500
+#define TLM_RATE_MAX    MUX_FREQ
+#else
+#define TLM_RATE_MAX    500
+#endif
+#endif
+
+/**
+ * @brief Telemetry sample (FRAME_TLM payload)
+ */
+typedef struct {
+	uint16_t seq;          /**< sample sequence number */
+	uint16_t adc_hv;       /**< raw HV ADC reading */
+	uint16_t adc_light;    /**< raw light sensor ADC reading */
+	uint8_t duty_cycle;    /**< SMPS duty cycle in % */
+	uint8_t dcf_state;     /**< DCF77 decoder state */
+	uint8_t hh;            /**< local time */
+	uint8_t mm;
+	uint8_t ss;
+	uint8_t subticks;      /**< 1/256s fraction of the current second */
+	uint16_t dcf_sync_cnt; /**< number of DCF77 syncs */
+	uint16_t drops;        /**< number of samples dropped so far */
+} __attribute__((packed)) tlm_sample_t;
+
+extern volatile uint16_t tlm_div;
+extern volatile uint16_t tlm_cnt;
+
+void tlm_set_rate(uint16_t hz);
+uint16_t tlm_rate(void);
+void tlm_send(tlm_sample_t *sample);
+
+/**
+ * @brief Check if telemetry is streaming (cheap enough for IRQ context).
+ */
+static inline uint8_t tlm_active(void)
+{
+	return tlm_div != 0;
+}
+
+/**
+ * @brief Advance the sample clock.
+ *
+ * Called from the mux IRQ, i.e. at MUX_FREQ, which runs it with the
+ * interrupts enabled.
+ *
+ * @return 1 if a sample is due
+ */
+static inline uint8_t tlm_tick(void)
+{
+	uint8_t due = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint16_t div = tlm_div;
+
+		if (div && ++tlm_cnt >= div) {
+			tlm_cnt = 0;
+			due = 1;
+		}
+	}
+	return due;
+}
+
+#endif
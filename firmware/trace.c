@@ -0,0 +1,142 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include "minixie.h"
+#include "uart.h"
+#include "frame.h"
+#include "diag.h"
+#include "trace.h"
+
+#if TRACE == 1
+
+volatile trace_t trace __attribute__((section(".noinit")));
+trace_rec_t trace_buf[TRACE_SIZE] __attribute__((section(".noinit")));
+
+/**
+ * @brief Start tracing, or keep the trace of the last reset.
+ *
+ * A frozen trace and the trace running when the watchdog fired are kept
+ * frozen; anything else starts over. Call after diag_init().
+ */
+void trace_init(void)
+{
+	if (trace.magic == TRACE_MAGIC && !(diag.mcucsr & _BV(PORF))) {
+		if ((diag.mcucsr & _BV(WDRF)) && !trace.frozen) {
+			trace.reason = TRACE_T_RESET;
+			trace.frozen = 1;
+		}
+		if (trace.frozen)
+			return;
+	}
+
+	trace.magic = TRACE_MAGIC;
+	trace.mask = TRACE_MASK_DEFAULT;
+	trace.triggers = TRACE_TRIG_DEFAULT;
+	trace_arm();
+}
+
+/**
+ * @brief Clear the ring and start recording.
+ */
+void trace_arm(void)
+{
+	cli();
+	trace.head = 0;
+	trace.count = 0;
+	trace.post = 0;
+	trace.reason = TRACE_T_NONE;
+	trace.frozen = 0;
+	sei();
+}
+
+/**
+ * @brief Freeze the ring after TRACE_POST more records.
+ *
+ * Only the first enabled trigger counts until the ring is re-armed. Safe
+ * in any context.
+ *
+ * @param[in] reason trace_trig_t
+ */
+void trace_trigger(uint8_t reason)
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	if (!trace.frozen && !trace.post && (trace.triggers & _BV(reason))) {
+		trace.reason = reason;
+		trace_put(TRACE_TRIG, reason);
+		trace.post = TRACE_POST;
+		if (!trace.post)
+			trace.frozen = 1;
+	}
+	SREG = sreg;
+}
+
+/**
+ * Queue a frame, waiting for room in the TX queue.
+ */
+static void send(const void *payload, uint8_t len)
+{
+	while (!frame_write(FRAME_TRACE, payload, len))
+		wdt_reset();
+}
+
+/**
+ * @brief Dump the ring as FRAME_TRACE frames, oldest record first.
+ *
+ * A running trace is frozen first. The first frame is a trace_hdr_t,
+ * the others carry a seq byte and up to TRACE_PER_FRAME records. Must
+ * not be called from IRQ context.
+ */
+void trace_dump(void)
+{
+	uint8_t frame[1 + TRACE_PER_FRAME * sizeof(trace_rec_t)];
+	trace_hdr_t hdr;
+	uint8_t i, n = 0;
+
+	trace.frozen = 1;
+
+	hdr.seq = 0;
+	hdr.count = trace.count;
+	hdr.reason = trace.reason;
+	hdr.mask = trace.mask;
+	hdr.triggers = trace.triggers;
+	hdr.slot_hz = F_CPU / 256;
+	send(&hdr, sizeof(hdr));
+
+	frame[0] = 1;
+	i = (trace.head - trace.count) & (TRACE_SIZE - 1);
+	for (uint8_t left = trace.count; left; left--) {
+		memcpy(frame + 1 + n * sizeof(trace_rec_t), &trace_buf[i], sizeof(trace_rec_t));
+		i = (i + 1) & (TRACE_SIZE - 1);
+		if (++n == TRACE_PER_FRAME || left == 1) {
+			send(frame, 1 + n * sizeof(trace_rec_t));
+			frame[0]++;
+			n = 0;
+		}
+	}
+}
+
+#endif
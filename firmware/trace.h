@@ -0,0 +1,244 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "mcu.h"
+
+/**
+ * Event trace: a RAM ring of the last TRACE_SIZE events, each a 4 byte
+ * record written in a few cycles from IRQs and tasks alike. The time is
+ * counted in mux slots (256 cycles, 32us) and wraps every 2.1s; it stands
+ * still while the mux is stopped, the order of the records still holds.
+ *
+ * Events come in classes which can be masked at run time, see
+ * trace_class_t. A trigger (UART overrun, HV trip, power fail, DCF77
+ * storm, the console or a watchdog reset) lets TRACE_POST more records in
+ * and then freezes the ring until it is re-armed. The ring is kept in
+ * .noinit, so a trace which froze, or the one running when the watchdog
+ * fired, survives the reset. `trace d` dumps it as FRAME_TRACE frames for
+ * tools/trace_view.py.
+ *
+ * Build with TRACE=1; without it the TRACE_* macros are empty.
+ */
+
+#ifndef TRACE
+#define TRACE           0
+#endif
+
+// records, a power of 2
+#ifndef TRACE_SIZE
+#if MCU_BIG_RAM == 1
+#define TRACE_SIZE      64
+#else
+#define TRACE_SIZE      32
+#endif
+#endif
+
+// records after a trigger
+#ifndef TRACE_POST
+#define TRACE_POST      (TRACE_SIZE/4)
+#endif
+
+#define TRACE_MAGIC     0x7ACE
+
+/**
+ * @brief Event classes, the high nibble of an event id
+ */
+typedef enum {
+	TRACE_C_IRQ = 0,    /**< IRQ entry and exit but the ones below */
+	TRACE_C_MUX,        /**< mux IRQ entry and exit */
+	TRACE_C_UART,       /**< UART IRQs and errors */
+	TRACE_C_DCF,        /**< DCF77 state transitions */
+	TRACE_C_EVENT,      /**< diag events: power, HV trips, syncs */
+	TRACE_C_TASK,       /**< main loop checkpoints and commands */
+	TRACE_C_SLEEP,      /**< sleep entry and exit */
+	TRACE_C_TRIGGER,    /**< triggers, always recorded */
+} trace_class_t;
+
+#define TRACE_MASK_DEFAULT  (0xFF & ~(_BV(TRACE_C_MUX) | _BV(TRACE_C_UART)))
+
+/**
+ * @brief Events, the argument is given for each
+ */
+typedef enum {
+	TRACE_IRQ_IN = TRACE_C_IRQ << 4,    /**< vector number */
+	TRACE_IRQ_OUT,                      /**< vector number */
+	TRACE_MUX_IN = TRACE_C_MUX << 4,    /**< - */
+	TRACE_MUX_OUT,                      /**< 1 if the next slot is late */
+	TRACE_UART_IN = TRACE_C_UART << 4,  /**< vector number */
+	TRACE_UART_OUT,                     /**< vector number */
+	TRACE_UART_ERR,                     /**< UCSRA */
+	TRACE_DCF_STATE = TRACE_C_DCF << 4, /**< new state, DCF_S_* */
+	TRACE_DCF_STORM,                    /**< - */
+	TRACE_DIAG_EV = TRACE_C_EVENT << 4, /**< diag_ev_t */
+	TRACE_TASK = TRACE_C_TASK << 4,     /**< diag_cp_t */
+	TRACE_CMD,                          /**< first character */
+	TRACE_SLEEP = TRACE_C_SLEEP << 4,   /**< SMCR (MCUCR on the ATmega8) */
+	TRACE_WAKE,                         /**< - */
+	TRACE_TRIG = TRACE_C_TRIGGER << 4,  /**< trace_trig_t */
+} trace_id_t;
+
+/**
+ * @brief IRQ vector numbers (ATmega8), the argument of IRQ events
+ *
+ * The other parts use the same ids; TRACE_V_INT1 is the button IRQ and
+ * TRACE_V_TIMER0_OVF the mux IRQ whichever vector they are.
+ */
+typedef enum {
+	TRACE_V_INT0 = 1,
+	TRACE_V_INT1 = 2,
+	TRACE_V_TIMER2_COMP = 3,
+	TRACE_V_TIMER2_OVF = 4,
+	TRACE_V_TIMER0_OVF = 9,
+	TRACE_V_USART_RXC = 11,
+	TRACE_V_USART_UDRE = 12,
+	TRACE_V_ADC = 14,
+	TRACE_V_ANA_COMP = 16,
+} trace_vect_t;
+
+/**
+ * @brief Triggers
+ */
+typedef enum {
+	TRACE_T_CONSOLE = 0,
+	TRACE_T_UART,       /**< RX overrun */
+	TRACE_T_HV,         /**< HV trip */
+	TRACE_T_PWR,        /**< power fail */
+	TRACE_T_STORM,      /**< DCF77 edge storm */
+	TRACE_T_RESET,      /**< watchdog reset */
+	TRACE_T_NONE = 0xFF,
+} trace_trig_t;
+
+#define TRACE_TRIG_DEFAULT  0xFF
+
+/**
+ * @brief Trace record
+ */
+typedef struct {
+	uint8_t id;         /**< trace_id_t */
+	uint8_t arg;
+	uint16_t time;      /**< in mux slots */
+} trace_rec_t;
+
+/**
+ * @brief Trace state
+ */
+typedef struct {
+	uint16_t magic;
+	uint16_t slots;     /**< time base, in mux slots */
+	uint8_t head;       /**< next record to write */
+	uint8_t count;      /**< valid records */
+	uint8_t post;       /**< records left until frozen, 0 if not triggered */
+	uint8_t frozen;
+	uint8_t reason;     /**< trace_trig_t of the trigger, TRACE_T_NONE if none */
+	uint8_t mask;       /**< enabled classes, bit per trace_class_t */
+	uint8_t triggers;   /**< enabled triggers, bit per trace_trig_t */
+} trace_t;
+
+/**
+ * @brief FRAME_TRACE payload of the first frame of a dump, seq 0
+ */
+typedef struct {
+	uint8_t seq;
+	uint8_t count;      /**< records in the following frames */
+	uint8_t reason;     /**< trace_trig_t */
+	uint8_t mask;
+	uint8_t triggers;
+	uint16_t slot_hz;   /**< time base */
+} __attribute__((packed)) trace_hdr_t;
+
+// records per FRAME_TRACE frame, after the seq byte
+#define TRACE_PER_FRAME 7
+
+extern volatile trace_t trace;
+extern trace_rec_t trace_buf[TRACE_SIZE];
+
+/**
+ * @brief Current time in 256 cycle units.
+ *
+ * With MUX_HWPWM the mux IRQ runs once per OCR0A + 1 of them, at the
+ * compare match in the last one, and TCNT0 counts them in between; a
+ * match the IRQ has not taken yet is counted as well.
+ */
+static inline uint16_t trace_time(void)
+{
+#if MUX_HWPWM == 1
+	uint8_t t = (TCNT0 + 1) & OCR0A;
+
+	if (TIFR0 & _BV(OCF0A))
+		t += OCR0A + 1;
+	return trace.slots + t;
+#else
+	return trace.slots;
+#endif
+}
+
+/**
+ * @brief Record an event.
+ *
+ * Safe in any context, IRQs are disabled while the record is written.
+ */
+static inline void trace_put(uint8_t id, uint8_t arg)
+{
+	uint8_t sreg;
+	trace_rec_t *r;
+
+	if (trace.frozen || !(trace.mask & _BV(id >> 4)))
+		return;
+
+	sreg = SREG;
+	cli();
+	r = &trace_buf[trace.head];
+	r->id = id;
+	r->arg = arg;
+	r->time = trace_time();
+	trace.head = (trace.head + 1) & (TRACE_SIZE - 1);
+	if (trace.count < TRACE_SIZE)
+		trace.count++;
+	if (trace.post && !--trace.post)
+		trace.frozen = 1;
+	SREG = sreg;
+}
+
+void trace_init(void);
+void trace_arm(void);
+void trace_trigger(uint8_t reason);
+void trace_dump(void);
+
+#if TRACE == 1
+#define TRACE_EVENT(id, arg)    trace_put((id), (arg))
+#define TRACE_TRIGGER(reason)   trace_trigger(reason)
+#if MUX_HWPWM == 1
+#define TRACE_SLOT()            (trace.slots += OCR0A + 1)
+#else
+#define TRACE_SLOT()            (trace.slots++)
+#endif
+#else
+#define TRACE_EVENT(id, arg)    ((void)0)
+#define TRACE_TRIGGER(reason)   ((void)0)
+#define TRACE_SLOT()            ((void)0)
+#endif
+
+#endif
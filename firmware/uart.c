@@ -24,6 +24,7 @@
 #include <avr/wdt.h>
 #include <util/delay.h>
 #include "uart.h"
+#include "trace.h"
 
 static inline void uart_tx(uint8_t u_id);
 static inline void uart_rx(uint8_t u_id);
@@ -46,12 +47,16 @@ static uart_ctx_t uart_ctx[] =
 
 ISR(USART_RXC_vect)
 {
+	TRACE_EVENT(TRACE_UART_IN, TRACE_V_USART_RXC);
 	uart_rx(UART0);
+	TRACE_EVENT(TRACE_UART_OUT, TRACE_V_USART_RXC);
 }
 
 ISR(USART_UDRE_vect)
 {
+	TRACE_EVENT(TRACE_UART_IN, TRACE_V_USART_UDRE);
 	uart_tx(UART0);
+	TRACE_EVENT(TRACE_UART_OUT, TRACE_V_USART_UDRE);
 }
 
 /**
@@ -81,8 +86,35 @@ static inline void uart_tx(uint8_t u_id)
 static inline void uart_rx(uint8_t u_id)
 {
 	psart_ctx_t u = (psart_ctx_t) &uart_ctx[u_id];
-	uint8_t c = UDR;
-	q_put(u->rx_queue, c);
+	// the error flags belong to the byte in UDR, read them first
+	uint8_t status = *u->pUCSRA;
+	uint8_t c = *u->pUDR;
+
+	if (status & (_BV(DOR) | _BV(FE) | _BV(PE)))
+		TRACE_EVENT(TRACE_UART_ERR, status);
+
+	if (status & _BV(DOR)) {
+		u->stats.overrun++;
+		TRACE_TRIGGER(TRACE_T_UART);
+	}
+
+	if (status & _BV(FE)) {
+		u->stats.framing++;
+		return;
+	}
+
+	if (status & _BV(PE)) {
+		u->stats.parity++;
+		return;
+	}
+
+	// bytes taken by the filter (binary frames) are neither queued nor
+	// signalled, the reader would find nothing
+	if (u->rx_filter != NULL && u->rx_filter(c))
+		return;
+
+	if (!q_put(u->rx_queue, c))
+		u->stats.rx_full++;
 
 	if (u->rx_cb != NULL) {
 		u->rx_cb(u_id);
@@ -160,15 +192,74 @@ uint8_t uart_write(uint8_t u_id, uint8_t *bp, uint8_t n)
 		if (!q_put(u->tx_queue, *bp++))
 			break;
 	}
+	u->stats.tx_full += n - i;
 	sei();
 
 	if (!(*u->pUCSRB & _BV(UDRIE))) {
+		// TXC is set again once all of it went out, see uart_tx_idle();
+		// it is cleared by writing a one, FE, DOR and PE are read-only
+		// and must be written as zero, U2X and MPCM are kept
+		*u->pUCSRA = (*u->pUCSRA & (_BV(U2X) | _BV(MPCM))) | _BV(TXC);
 		*u->pUCSRB |= _BV(UDRIE);
 	}
 
 	return i;
 }
 
+/**
+ \brief Get number of bytes which can be written without blocking.
+
+ \param u_id usart port number
+ */
+uint8_t uart_tx_free(uint8_t u_id)
+{
+	psart_ctx_t u = (psart_ctx_t) &uart_ctx[u_id];
+	return q_free(u->tx_queue);
+}
+
+/**
+ \brief Check if the transmitter is done, e.g. before clkIO is stopped.
+
+ \param u_id usart port number
+ */
+uint8_t uart_tx_idle(uint8_t u_id)
+{
+	psart_ctx_t u = (psart_ctx_t) &uart_ctx[u_id];
+	return q_is_empty(u->tx_queue) && (*u->pUCSRA & _BV(TXC));
+}
+
+/**
+ \brief Get a copy of the error counters.
+
+ \param u_id usart port number
+ \param stats destination
+ */
+void uart_stats(uint8_t u_id, uart_stats_t *stats)
+{
+	psart_ctx_t u = (psart_ctx_t) &uart_ctx[u_id];
+
+	cli();
+	*stats = u->stats;
+	sei();
+}
+
+/**
+ \brief Set a filter which sees every received byte before it is queued.
+
+ The filter runs in IRQ context.
+
+ \param u_id usart port number
+ \param filter the filter, NULL to queue all bytes
+ */
+void uart_set_filter(uint8_t u_id, uart_filter_t filter)
+{
+	psart_ctx_t u = &uart_ctx[u_id];
+
+	cli();
+	u->rx_filter = filter;
+	sei();
+}
+
 /**
  Initialise UART
  */
@@ -180,12 +271,12 @@ void uart_init(uint8_t u_id, uint16_t baud, uart_cb_t rx_cb, uart_cb_t tx_cb)
 	*u->pUBRRL = baud & 0xFF;
 	*u->pUBRRH = baud >> 8;
 	*u->pUCSRB = _BV(RXCIE) | _BV(RXEN) | _BV(TXEN);
-	*u->pUCSRC = _BV(URSEL) | _BV(UCSZ1) | _BV(UCSZ0);
+	*u->pUCSRC = UART_URSEL | _BV(UCSZ1) | _BV(UCSZ0);
 }
 
 void uart_deinit(uint8_t u_id)
 {
 	psart_ctx_t u = &uart_ctx[u_id];
-	*u->pUCSRB &= ~(_BV(RXEN) | _BV(TXEN | _BV(RXCIE) | _BV(UDRIE)));
+	*u->pUCSRB &= ~(_BV(RXEN) | _BV(TXEN) | _BV(RXCIE) | _BV(UDRIE));
 }
 
@@ -29,10 +29,15 @@
 #include <string.h>
 #include <stdio.h>
 #include "queue.h"
+#include "mcu.h"
 
 #ifndef UART_QUEUE_SIZE
+#if MCU_BIG_RAM == 1
+#define UART_QUEUE_SIZE    200
+#else
 #define UART_QUEUE_SIZE    100
 #endif
+#endif
 
 #define UART_WAIT_COUNT    100
 
@@ -49,6 +54,22 @@ typedef enum {
 
 typedef void (*uart_cb_t)(uint8_t u_id);
 
+/**
+ * @brief RX byte filter, returns 1 if it took the byte, see uart_set_filter()
+ */
+typedef uint8_t (*uart_filter_t)(uint8_t c);
+
+/**
+ * @brief Error counters, see uart_stats()
+ */
+typedef struct {
+    uint16_t overrun;   /**< bytes lost by the receiver (DOR) */
+    uint16_t framing;   /**< bytes dropped on a framing error (FE) */
+    uint16_t parity;    /**< bytes dropped on a parity error (PE) */
+    uint16_t rx_full;   /**< bytes dropped because the RX queue was full */
+    uint16_t tx_full;   /**< bytes not written because the TX queue was full */
+} uart_stats_t;
+
 typedef struct {
     uint8_t u_id;
     usart_mode_t u_mode;
@@ -57,6 +78,7 @@ typedef struct {
 
     uart_cb_t rx_cb;
     uart_cb_t tx_cb;
+    uart_filter_t rx_filter;
 
     uint8_t *pUDR;
     uint8_t *pUCSRA;
@@ -64,6 +86,8 @@ typedef struct {
     uint8_t *pUCSRC;
     uint8_t *pUBRRL;
     uint8_t *pUBRRH;
+
+    uart_stats_t stats;
 } uart_ctx_t, *psart_ctx_t;
 
 #define UART_BAUD_SELECT(baudRate) ((F_CPU)/16/(baudRate)-1)
@@ -73,5 +97,9 @@ void uart_deinit(uint8_t u_id);
 
 uint8_t uart_write(uint8_t u_id, uint8_t *bp, uint8_t n);
 uint8_t uart_read(uint8_t u_id, uint8_t *bp, uint8_t n);
+uint8_t uart_tx_free(uint8_t u_id);
+uint8_t uart_tx_idle(uint8_t u_id);
+void uart_stats(uint8_t u_id, uart_stats_t *stats);
+void uart_set_filter(uint8_t u_id, uart_filter_t filter);
 
 #endif
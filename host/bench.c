@@ -0,0 +1,142 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/**
+ * @brief Host microbenchmarks of the firmware modules.
+ *
+ *     bench [seconds per benchmark]
+ *
+ * - queue: bytes/s through a UART sized queue_t
+ * - dcf77: frames/s through the edge filter, the pulse state machine and
+ *   the decoder, fed with the edges of a valid signal
+ * - logger: messages/s through log_printf(), the UART TX queue and the
+ *   UDRE IRQ
+ *
+ * The figures are for comparing changes on the same machine; they say
+ * nothing about the cycle counts on the ATmega8, see tools/isrbench.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <avr/io.h>
+#include "queue.h"
+#include "uart.h"
+#include "logger.h"
+#include "rtc.h"
+#include "dcf77.h"
+#include "minixie.h"
+#include "mock.h"
+
+static double bench_time;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void result(const char *name, double count, const char *unit, double elapsed)
+{
+	fprintf(host_out, "%-8s %14.0f %s/s\n", name, count / elapsed, unit);
+}
+
+static void bench_queue(void)
+{
+	queue_t *q = Q_INIT(UART_QUEUE_SIZE);
+	volatile uint8_t sink = 0;
+	double start = now(), elapsed;
+	uint64_t bytes = 0;
+	uint8_t b;
+
+	do {
+		for (int i = 0; i < 1000; i++) {
+			uint8_t n = 0;
+			while (q_put(q, n))
+				n++;
+			while (q_get(q, &b))
+				sink += b;
+			bytes += n;
+		}
+	} while ((elapsed = now() - start) < bench_time);
+
+	result("queue", bytes, "bytes", elapsed);
+}
+
+static void bench_dcf(void)
+{
+	double start = now(), elapsed;
+	uint32_t frames = 0, minutes = 0;
+	dcf_time_t t;
+
+	rtc_init(NULL);
+	dcf77_enable(1);
+
+	do {
+		uint8_t mm = minutes % 60, hh = minutes / 60 % 24;
+		uint64_t bits = mock_dcf_frame(mm == 59 ? (hh + 1) % 24 : hh, (mm + 1) % 60);
+
+		for (int s = 0; s < 60; s++) {
+			uint8_t events = mock_dcf_second(s != 59, (bits >> s) & 1);
+			if ((events & DCF_EV_FRAME) && dcf77_decode(&dcf_frame, &t))
+				frames++;
+		}
+		minutes++;
+	} while ((elapsed = now() - start) < bench_time);
+
+	// the first minute only brings the first mark
+	if (frames + 2 < minutes)
+		fprintf(host_out, "dcf77: %u of %u frames decoded\n", frames, minutes);
+
+	result("dcf77", frames, "frames", elapsed);
+}
+
+static void bench_logger(void)
+{
+	double start = now(), elapsed;
+	uint32_t messages = 0;
+
+	uart_init(UART0, UART_BAUD_SELECT(19200), NULL, NULL);
+	log_init();
+
+	do {
+		for (int i = 0; i < 100; i++) {
+			log_info("HV:%ld Light:%d DC:%d", 170L, i, 80);
+			mock_uart_drain();
+		}
+		messages += 100;
+	} while ((elapsed = now() - start) < bench_time);
+
+	result("logger", messages, "messages", elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+	bench_time = argc > 1 ? atof(argv[1]) : 1.0;
+
+	mock_reset();
+	bench_queue();
+	bench_dcf();
+	bench_logger();
+
+	return 0;
+}
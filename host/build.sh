@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# Minixie - a simple nixie tube clock.
+# Copyright (C) 2012-2014, Wojciech Bober
+#
+# Build all firmware modules natively against the mock headers in
+# host/include, then build and run the tests and the microbenchmarks.
+# The script fails if a module doesn't build without warnings or a test
+# fails.
+#
+#     host/build.sh [seconds per benchmark]
+#
+# Extra compiler flags can be passed in CFLAGS, e.g. CFLAGS=-DUART_QUEUE_SIZE=64.
+#
+# License: GNU GPL v2 or later, see LICENSE.
+
+set -e
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+out=${OUT:-$top/build/host}
+cc=${CC:-cc}
+
+# DIAG_PC, RTC_PPS and PROF hook the RTC vectors with AVR assembly
+flags="-std=gnu99 -O2 -Wall -Werror
+	-DF_CPU=8000000UL -DDIAG_PC=0 -DRTC_PPS=0 -DPROF=0 -isystem $top/host/include -I$top/firmware -I$top/host"
+
+mkdir -p "$out"
+
+for f in "$top"/firmware/*.c; do
+	$cc $flags $CFLAGS -c "$f" -o "$out/$(basename "${f%.c}").o"
+done
+
+objs="$out/dcf77.o $out/rtc.o $out/logger.o $out/uart.o $out/trace.o $out/diag.o $out/frame.o"
+
+for t in test bench; do
+	$cc $flags $CFLAGS -o "$out/$t" "$top/host/$t.c" "$top/host/mock.c" $objs
+done
+
+"$out/test"
+"$out/bench" "$@"
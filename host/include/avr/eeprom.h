@@ -0,0 +1,17 @@
+/* Host build: the EEMEM variables themselves hold the data, see mock.c. */
+#ifndef _HOST_AVR_EEPROM_H_
+#define _HOST_AVR_EEPROM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EEMEM
+#define eeprom_busy_wait() do {} while (0)
+
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_write_block(const void *src, void *dst, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+uint8_t eeprom_read_byte(const uint8_t *p);
+void eeprom_update_byte(uint8_t *p, uint8_t value);
+
+#endif
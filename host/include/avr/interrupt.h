@@ -0,0 +1,18 @@
+/* Host build: IRQ handlers are plain functions, the I flag lives in SREG. */
+#ifndef _HOST_AVR_INTERRUPT_H_
+#define _HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(v, ...) void v(void); void v(void)
+#define ISR_NOBLOCK
+#define ISR_NAKED
+// AVR function attributes, __attribute__((OS_main)) becomes empty
+#define OS_main
+#define ISR_ALIASOF(x)
+#define EMPTY_INTERRUPT(v) void v(void) {}
+#define reti()
+#define sei() (SREG |= 0x80)
+#define cli() (SREG &= ~0x80)
+
+#endif
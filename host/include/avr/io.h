@@ -0,0 +1,173 @@
+/* Host build: ATmega8 registers and bit numbers. */
+#ifndef _HOST_AVR_IO_H_
+#define _HOST_AVR_IO_H_
+
+#include <stdint.h>
+#define _BV(b) (1 << (b))
+#define bit_is_set(r,b) ((r) & _BV(b))
+#define bit_is_clear(r,b) (!((r) & _BV(b)))
+
+/*
+ * The I/O registers are plain variables, defined in host/mock.c. A test
+ * or benchmark drives the peripherals by writing them and calling the
+ * IRQ handlers, which are ordinary functions (see avr/interrupt.h).
+ */
+#define HOST_REGS(R8, R16) \
+	R8(PORTB) R8(PORTC) R8(PORTD) R8(DDRB) R8(DDRC) R8(DDRD) R8(PINB) R8(PINC) R8(PIND) \
+	R8(MCUCR) R8(GICR) R8(GIFR) R8(TIMSK) R8(TIFR) R8(TCCR0) R8(TCNT0) R8(TCCR1A) R8(TCCR1B) \
+	R16(ICR1) R16(OCR1A) R16(OCR1B) R16(TCNT1) R8(TCCR2) R8(TCNT2) R8(OCR2) R8(ASSR) R8(ACSR) \
+	R8(ADCSRA) R8(ADMUX) R16(ADC) R8(ADCL) R8(ADCH) R8(UDR) R8(UCSRA) R8(UCSRB) R8(UCSRC) \
+	R8(UBRRL) R8(UBRRH) R8(MCUCSR) R8(WDTCR) R8(SREG) R8(SFIOR) R8(EEARL) R8(EEARH) R16(EEAR) \
+	R8(EEDR) R8(EECR) R8(SPL) R8(SPH) R16(SP) R8(OSCCAL)
+
+#define HOST_R8(n)  extern volatile uint8_t n;
+#define HOST_R16(n) extern volatile uint16_t n;
+HOST_REGS(HOST_R8, HOST_R16)
+#undef HOST_R8
+#undef HOST_R16
+
+/* bits */
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PIND2 2
+#define PIND3 3
+#define PIND4 4
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+#define SM0 4
+#define SM1 5
+#define SM2 6
+#define SE 7
+#define INT0 6
+#define INT1 7
+#define INTF0 6
+#define INTF1 7
+#define TOIE0 0
+#define TOIE1 2
+#define OCIE1B 3
+#define OCIE1A 4
+#define TICIE1 5
+#define TOIE2 6
+#define OCIE2 7
+#define TOV0 0
+#define TOV1 2
+#define OCF1B 3
+#define OCF1A 4
+#define ICF1 5
+#define TOV2 6
+#define OCF2 7
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM10 0
+#define WGM11 1
+#define FOC1B 2
+#define FOC1A 3
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define ICES1 6
+#define ICNC1 7
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM21 3
+#define COM20 4
+#define COM21 5
+#define WGM20 6
+#define FOC2 7
+#define TCR2UB 0
+#define OCR2UB 1
+#define TCN2UB 2
+#define AS2 3
+#define ACIS0 0
+#define ACIS1 1
+#define ACIC 2
+#define ACIE 3
+#define ACI 4
+#define ACO 5
+#define ACBG 6
+#define ACD 7
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADFR 5
+#define ADSC 6
+#define ADEN 7
+#define MUX0 0
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+#define MPCM 0
+#define U2X 1
+#define PE 2
+#define DOR 3
+#define FE 4
+#define UDRE 5
+#define TXC 6
+#define RXC 7
+#define TXB8 0
+#define RXB8 1
+#define UCSZ2 2
+#define TXEN 3
+#define RXEN 4
+#define UDRIE 5
+#define TXCIE 6
+#define RXCIE 7
+#define UCPOL 0
+#define UCSZ0 1
+#define UCSZ1 2
+#define USBS 3
+#define UPM0 4
+#define UPM1 5
+#define UMSEL 6
+#define URSEL 7
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+#define WDP0 0
+#define WDE 3
+#define WDCE 4
+#define EERE 0
+#define EEWE 1
+#define EEMWE 2
+#define EERIE 3
+#define PUD 2
+#define ACME 3
+#define RAMEND 0x45F
+#define FLASHEND 0x1FFF
+#define E2END 0x1FF
+
+#endif
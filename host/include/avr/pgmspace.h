@@ -0,0 +1,28 @@
+/* Host build: flash is ordinary memory; the *_P printf family is in mock.c. */
+#ifndef _HOST_AVR_PGMSPACE_H_
+#define _HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(a) (*(const uint8_t *)(a))
+#define pgm_read_word(a) (*(const uint16_t *)(a))
+#define pgm_read_dword(a) (*(const uint32_t *)(a))
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strstr_P strstr
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+int fprintf_P(FILE *, const char *, ...);
+int vfprintf_P(FILE *, const char *, va_list);
+int printf_P(const char *, ...);
+int sprintf_P(char *, const char *, ...);
+int snprintf_P(char *, size_t, const char *, ...);
+
+#endif
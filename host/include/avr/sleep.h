@@ -0,0 +1,13 @@
+/* Host build: sleeping returns right away. */
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC 1
+#define SLEEP_MODE_PWR_DOWN 2
+#define SLEEP_MODE_PWR_SAVE 3
+#define SLEEP_MODE_STANDBY 6
+#define set_sleep_mode(m) ((void)(m))
+#define sleep_mode() do {} while (0)
+#define sleep_enable() do {} while (0)
+#define sleep_disable() do {} while (0)
+#define sleep_cpu() do {} while (0)
@@ -0,0 +1,5 @@
+/* Host build: rtc.h has its own clock_t, keep libc's out of the way. */
+#define clock_t __host_clock_t
+#include_next <stdio.h>
+#undef clock_t
+FILE *fdevopen(int (*)(char, FILE *), int (*)(FILE *));
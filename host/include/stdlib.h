@@ -0,0 +1,4 @@
+/* Host build: see stdio.h */
+#define clock_t __host_clock_t
+#include_next <stdlib.h>
+#undef clock_t
@@ -0,0 +1,6 @@
+/* Host build: there is nothing to interrupt an atomic block. */
+#define ATOMIC_BLOCK(t) for (int __t = 1; __t; __t = 0)
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define NONATOMIC_BLOCK(t) for (int __t = 1; __t; __t = 0)
+#define NONATOMIC_RESTORESTATE
@@ -0,0 +1,3 @@
+/* Host build: delays return right away. */
+#define _delay_ms(x) ((void)(x))
+#define _delay_us(x) ((void)(x))
@@ -0,0 +1,298 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/**
+ * @brief Mock peripherals and avr-libc functions for the host build.
+ *
+ * Registers are plain variables which keep what was written, nothing
+ * happens on its own: the caller sets e.g. PIND or TCNT2 and calls the
+ * IRQ handler it wants to run.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "minixie.h"
+#include "dcf77.h"
+#include "mock.h"
+
+#define DCF_PULSE_0     (DCF_HANDLER_FREQ/10)
+#define DCF_PULSE_1     (DCF_HANDLER_FREQ/5)
+
+#define HOST_R8(n)  volatile uint8_t n;
+#define HOST_R16(n) volatile uint16_t n;
+HOST_REGS(HOST_R8, HOST_R16)
+
+FILE *host_out;
+
+void USART_UDRE_vect(void);
+void TIMER2_OVF_vect(void);
+
+static int (*dev_put)(char, FILE *);
+static int (*dev_get)(FILE *);
+
+__attribute__((constructor))
+static void mock_init(void)
+{
+	host_out = stdout;
+}
+
+/**
+ * @brief Clear all registers, as after a reset.
+ */
+void mock_reset(void)
+{
+#define HOST_CLEAR(n) n = 0;
+	HOST_REGS(HOST_CLEAR, HOST_CLEAR)
+#undef HOST_CLEAR
+}
+
+/**
+ * @brief Run the UDRE IRQ until the UART TX queue is empty.
+ */
+void mock_uart_drain(void)
+{
+	while (UCSRB & _BV(UDRIE))
+		USART_UDRE_vect();
+}
+
+/**
+ * @brief Run the UDRE IRQ until the UART TX queue is empty and keep what
+ * was sent.
+ *
+ * @return number of bytes sent, at most n - 1 are stored, NUL terminated
+ */
+size_t mock_uart_capture(char *buf, size_t n)
+{
+	size_t len = 0;
+
+	while (UCSRB & _BV(UDRIE)) {
+		USART_UDRE_vect();
+		// the IRQ found the queue empty, nothing was written to UDR
+		if (!(UCSRB & _BV(UDRIE)))
+			break;
+		if (len + 1 < n)
+			buf[len] = UDR;
+		len++;
+	}
+	if (n)
+		buf[len < n ? len : n - 1] = 0;
+
+	return len;
+}
+
+static uint8_t bcd(uint8_t v)
+{
+	return ((v / 10) << 4) | (v % 10);
+}
+
+static uint64_t parity(uint64_t bits, int from, int to)
+{
+	uint64_t p = 0;
+	for (int i = from; i < to; i++)
+		p ^= (bits >> i) & 1;
+	return p << to;
+}
+
+/**
+ * @brief DCF77 frame for hh:mm on Wednesday, 2014-01-01, CET.
+ */
+uint64_t mock_dcf_frame(uint8_t hh, uint8_t mm)
+{
+	uint64_t bits = 0;
+
+	bits |= 1ULL << 18;
+	bits |= 1ULL << 20;
+	bits |= (uint64_t)bcd(mm) << 21;
+	bits |= parity(bits, 21, 28);
+	bits |= (uint64_t)bcd(hh) << 29;
+	bits |= parity(bits, 29, 35);
+	bits |= (uint64_t)bcd(1) << 36;
+	bits |= (uint64_t)3 << 42;
+	bits |= (uint64_t)bcd(1) << 45;
+	bits |= (uint64_t)bcd(14) << 50;
+	bits |= parity(bits, 36, 58);
+
+	return bits;
+}
+
+/**
+ * @brief One second of the DCF77 signal: a pulse of 100 or 200ms at its
+ * start, or none in the minute mark. Runs the edge IRQ, the RTC overflow
+ * and dcf77_second().
+ *
+ * @return the decoder events
+ */
+uint8_t mock_dcf_second(int pulse, int one)
+{
+	uint8_t events = 0;
+
+	if (pulse) {
+		TCNT2 = 0;
+		PIND |= _BV(DCF_BIT);
+		events |= dcf77_edge();
+		TCNT2 = one ? DCF_PULSE_1 : DCF_PULSE_0;
+		PIND &= ~_BV(DCF_BIT);
+		events |= dcf77_edge();
+	}
+
+	TCNT2 = 0;
+	TIMER2_OVF_vect();
+	dcf77_second();
+
+	return events;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	memcpy(dst, src, n);
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t n)
+{
+	memcpy(dst, src, n);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+	memcpy(dst, src, n);
+}
+
+uint8_t eeprom_read_byte(const uint8_t *p)
+{
+	return *p;
+}
+
+void eeprom_update_byte(uint8_t *p, uint8_t value)
+{
+	*p = value;
+}
+
+static ssize_t dev_write(void *cookie, const char *buf, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		dev_put(buf[i], cookie);
+	return n;
+}
+
+static ssize_t dev_read(void *cookie, char *buf, size_t n)
+{
+	int c = dev_get(cookie);
+	if (c < 0)
+		return 0;
+	buf[0] = c;
+	return 1;
+}
+
+/**
+ * Like avr-libc, the first stream opened for writing becomes stdout.
+ * It is unbuffered so that put() sees every character as it is printed.
+ */
+FILE *fdevopen(int (*put)(char, FILE *), int (*get)(FILE *))
+{
+	cookie_io_functions_t io = {
+		.read = get ? dev_read : NULL,
+		.write = put ? dev_write : NULL,
+	};
+	FILE *f;
+
+	dev_put = put;
+	dev_get = get;
+	if (!(f = fopencookie(NULL, put ? "r+" : "r", io)))
+		return NULL;
+	setvbuf(f, NULL, _IONBF, 0);
+
+	if (put)
+		stdout = f;
+	return f;
+}
+
+/**
+ * avr-libc's %S prints a string from flash, which is %s here.
+ */
+static const char *host_format(const char *fmt, char *buf, size_t n)
+{
+	size_t i = 0;
+
+	if (strlen(fmt) >= n)
+		return fmt;
+
+	while (*fmt) {
+		buf[i++] = *fmt;
+		if (*fmt++ != '%')
+			continue;
+		while (*fmt && strchr("-+ #0123456789.hlz", *fmt))
+			buf[i++] = *fmt++;
+		if (*fmt)
+			buf[i++] = *fmt == 'S' ? 's' : *fmt, fmt++;
+	}
+	buf[i] = 0;
+
+	return buf;
+}
+
+int vfprintf_P(FILE *f, const char *fmt, va_list ap)
+{
+	char buf[256];
+	return vfprintf(f, host_format(fmt, buf, sizeof(buf)), ap);
+}
+
+int fprintf_P(FILE *f, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vfprintf_P(f, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+int printf_P(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vfprintf_P(stdout, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+int sprintf_P(char *s, const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsprintf(s, host_format(fmt, buf, sizeof(buf)), ap);
+	va_end(ap);
+	return n;
+}
+
+int snprintf_P(char *s, size_t size, const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(s, size, host_format(fmt, buf, sizeof(buf)), ap);
+	va_end(ap);
+	return n;
+}
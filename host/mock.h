@@ -0,0 +1,40 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef _MOCK_H_
+#define _MOCK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * @brief The host's stdout. Once log_init() ran the firmware's stdout is
+ * the UART, as on the target.
+ */
+extern FILE *host_out;
+
+void mock_reset(void);
+void mock_uart_drain(void);
+size_t mock_uart_capture(char *buf, size_t n);
+
+uint64_t mock_dcf_frame(uint8_t hh, uint8_t mm);
+uint8_t mock_dcf_second(int pulse, int one);
+
+#endif
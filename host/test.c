@@ -0,0 +1,262 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/**
+ * @brief Host tests of the firmware modules.
+ *
+ *     test
+ *
+ * Prints the failed checks and exits with the number of failures, so
+ * host/build.sh stops on the first broken build.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include "queue.h"
+#include "uart.h"
+#include "logger.h"
+#include "rtc.h"
+#include "dcf77.h"
+#include "mock.h"
+
+void TIMER2_OVF_vect(void);
+
+static int failures;
+
+#define CHECK(_cond) do { \
+		if (!(_cond)) { \
+			fprintf(host_out, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #_cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static void test_queue(void)
+{
+	queue_t *q = Q_INIT(5);
+	uint8_t b = 0;
+	int i;
+
+	CHECK(q_is_empty(q));
+	CHECK(q_free(q) == 4);
+	CHECK(!q_get(q, &b));
+
+	for (i = 0; i < 4; i++)
+		CHECK(q_put(q, i));
+	CHECK(!q_put(q, 4));
+	CHECK(q_free(q) == 0);
+
+	// wrap the indices around a couple of times, keeping the order
+	for (i = 4; i < 20; i++) {
+		CHECK(q_get(q, &b) && b == i - 4);
+		CHECK(q_put(q, i));
+		CHECK(!q_put(q, 0xff));
+	}
+
+	for (i = 16; i < 20; i++)
+		CHECK(q_get(q, &b) && b == i);
+	CHECK(!q_get(q, &b));
+	CHECK(q_is_empty(q));
+	CHECK(q_free(q) == 4);
+}
+
+static void test_logger(void)
+{
+	char buf[64];
+
+	uart_init(UART0, UART_BAUD_SELECT(19200), NULL, NULL);
+	log_init();
+
+	log_printf(LABEL_INFO, PSTR("main.c"), 42, PSTR("HV:%ld Light:%d"), 170L, 3);
+	CHECK(mock_uart_capture(buf, sizeof(buf)) == 31);
+	CHECK(strcmp(buf, "INFO main.c:42 HV:170 Light:3" LOG_LINE_SEPARATOR) == 0);
+
+	log_printf(LABEL_WARN, PSTR("dcf77.c"), 7, PSTR("%S"), PSTR("storm"));
+	mock_uart_capture(buf, sizeof(buf));
+	CHECK(strcmp(buf, "WARN dcf77.c:7 storm" LOG_LINE_SEPARATOR) == 0);
+}
+
+/**
+ * Feed seconds 1..len-1 of a minute, the last one without a pulse, and
+ * the mark at second 0 of the next one. Returns 1 and the decoded time if
+ * the mark ended a valid frame.
+ */
+static int dcf_receive(uint64_t bits, int len, dcf_time_t *t)
+{
+	uint8_t events;
+
+	for (int s = 1; s < len; s++)
+		mock_dcf_second(s != len - 1, (bits >> s) & 1);
+	events = mock_dcf_second(1, 0);
+
+	CHECK(events & DCF_EV_MARK);
+	return (events & DCF_EV_FRAME) && dcf77_decode(&dcf_frame, t);
+}
+
+static void test_dcf77(void)
+{
+	dcf_time_t t;
+	uint64_t bits;
+
+	rtc_init(NULL);
+	dcf77_enable(1);
+
+	// pulses, the gap of a minute mark and the mark itself
+	mock_dcf_second(1, 0);
+	mock_dcf_second(0, 0);
+	mock_dcf_second(0, 0);
+	CHECK(mock_dcf_second(1, 0) == DCF_EV_MARK);
+
+	memset(&t, 0, sizeof(t));
+	CHECK(dcf_receive(mock_dcf_frame(21, 37), 60, &t));
+	CHECK(t.hour == 21 && t.minute == 37);
+	CHECK(t.day == 1 && t.weekday == 3 && t.month == 1 && t.year == 14);
+	CHECK(t.flags & (1 << DCF_F_CET));
+	CHECK(!(t.flags & (1 << DCF_F_CEST)));
+	CHECK(!(t.flags & (1 << DCF_F_LEAP_SECOND)));
+
+	// a flipped minute bit breaks the minute parity
+	bits = mock_dcf_frame(21, 38) ^ (1ULL << 21);
+	CHECK(!dcf_receive(bits, 60, &t));
+
+	// the receiver resynchronizes on the next mark
+	CHECK(dcf_receive(mock_dcf_frame(21, 39), 60, &t));
+	CHECK(t.hour == 21 && t.minute == 39);
+
+	// leap second: announced by bit 19, a 0 in second 59 and no pulse
+	// in second 60
+	bits = mock_dcf_frame(23, 59) | (1ULL << 19);
+	CHECK(dcf_receive(bits, 61, &t));
+	CHECK(t.hour == 23 && t.minute == 59);
+	CHECK(t.flags & (1 << DCF_F_LEAP_SECOND));
+
+	// and a normal minute after it
+	CHECK(dcf_receive(mock_dcf_frame(0, 0), 60, &t));
+	CHECK(t.hour == 0 && t.minute == 0);
+
+	dcf77_enable(0);
+}
+
+/**
+ * Run the RTC overflow IRQ until the trim moves TCNT2 away from 0.
+ * Returns the number of seconds it took.
+ */
+static int rtc_until_step(void)
+{
+	int n = 0;
+
+	do {
+		TCNT2 = 0;
+		TIMER2_OVF_vect();
+		n++;
+	} while (TCNT2 == 0 && n < 1000);
+
+	return n;
+}
+
+static void test_rtc_trim(void)
+{
+	rtc_stamp_t a, b;
+	int n;
+
+	mock_reset();
+	rtc_init(NULL);
+	// the mock keeps the 1 written to clear TOV2, nothing is pending
+	TIFR2 = 0;
+
+	// +200ppm: one tick in 390625 / 20000 seconds, the second is
+	// shortened by starting it at TCNT2 = 1
+	rtc_set_trim(RTC_TRIM_MAX);
+	rtc_snapshot(&a, NULL);
+	n = rtc_until_step();
+	rtc_snapshot(&b, NULL);
+	CHECK(n == (RTC_TRIM_TICK + RTC_TRIM_MAX - 1) / RTC_TRIM_MAX);
+	CHECK(TCNT2 == 1);
+	CHECK(b.seconds - a.seconds == n);
+
+	// -200ppm: the second is lengthened by an extra overflow which doesn't
+	// count as a second
+	rtc_set_trim(-RTC_TRIM_MAX);
+	n = rtc_until_step();
+	CHECK(n == (RTC_TRIM_TICK + RTC_TRIM_MAX - 1) / RTC_TRIM_MAX);
+	CHECK(TCNT2 == RTC_TICKS_PER_SEC - 1);
+
+	rtc_snapshot(&a, NULL);
+	TCNT2 = 0;
+	TIMER2_OVF_vect();
+	rtc_snapshot(&b, NULL);
+	CHECK(b.seconds == a.seconds);
+	TCNT2 = 0;
+	TIMER2_OVF_vect();
+	rtc_snapshot(&b, NULL);
+	CHECK(b.seconds == a.seconds + 1);
+
+	rtc_set_trim(0);
+}
+
+static void rtc_seconds(int n)
+{
+	while (n--) {
+		TCNT2 = 0;
+		TIMER2_OVF_vect();
+	}
+}
+
+static void test_rtc_drift(void)
+{
+	rtc_stamp_t mark = { .seconds = 0 };
+
+	mock_reset();
+	rtc_init(NULL);
+	TIFR2 = 0;
+	rtc_drift.valid = 0;
+
+	// the first offset is slewed and anchors the estimation
+	rtc_correct(&mark, -3, 1);
+	CHECK(rtc_drift.sum == 0);
+	rtc_seconds(1);
+
+	// 2 ticks were still to be slewed, the rest is drift
+	rtc_correct(&mark, -10, 1);
+	CHECK(rtc_drift.sum == -8);
+	rtc_seconds(4);
+
+	// nothing but the unapplied slew
+	rtc_correct(&mark, -6, 1);
+	CHECK(rtc_drift.sum == -8);
+	rtc_seconds(6);
+
+	rtc_drift.valid = 0;
+}
+
+int main(void)
+{
+	mock_reset();
+	test_queue();
+	test_logger();
+	test_dcf77();
+	test_rtc_trim();
+	test_rtc_drift();
+
+	fprintf(host_out, "test: %d failed\n", failures);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# Minixie - a simple nixie tube clock.
+# Copyright (C) 2012-2014, Wojciech Bober
+#
+# Build a CHAIN=1, RTC_PPS=1 firmware image with symbols and the chainsim runner, then
+# run it.
+#
+#     tools/chainsim/build.sh [chainsim options]
+#
+# Needs avr-gcc and simavr (headers and libsimavr). The image is built
+# with the flags of the AVR Studio project; extra compiler flags can be
+# passed in CFLAGS, e.g. CFLAGS=-fno-inline-small-functions. MCU selects
+# the part, e.g. MCU=atmega328p (default atmega8).
+#
+# License: GNU GPL v2 or later, see LICENSE.
+
+set -e
+
+top=$(cd "$(dirname "$0")/../.." && pwd)
+mcu=${MCU:-atmega8}
+out=${OUT:-$top/build/chainsim/$mcu}
+
+mkdir -p "$out"
+
+avr-gcc -mmcu=$mcu -Wall -gdwarf-2 -std=gnu99 -DF_CPU=8000000UL -Os -fsigned-char \
+	-DCHAIN=1 -DRTC_PPS=1 $CFLAGS -o "$out/minixie.elf" "$top"/firmware/*.c
+avr-size "$out/minixie.elf"
+
+if pkg-config --exists simavr 2>/dev/null; then
+	sim_cflags=$(pkg-config --cflags simavr)
+	sim_libs=$(pkg-config --libs simavr)
+else
+	sim_cflags="-I${SIMAVR:-/usr}/include/simavr"
+	sim_libs="-L${SIMAVR:-/usr}/lib -lsimavr -lelf"
+fi
+
+cc -std=gnu99 -O2 -Wall $sim_cflags -o "$out/chainsim" "$top/tools/chainsim/chainsim.c" $sim_libs -lm
+
+"$out/chainsim" -m "$mcu" "$@" "$out/minixie.elf"
@@ -0,0 +1,482 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/**
+ * @brief A daisy chain of simulated clocks (simavr).
+ *
+ *     chainsim [-m mcu] [-n clocks] [-t seconds] [-p ppm,ppm,...]
+ *              [-o offsets.csv] [-c pps.csv] minixie.elf
+ *
+ * Runs several instances of a CHAIN=1 image with the UART TX of each
+ * wired to the RX of the next. The first one is made the master and gets
+ * a DCF77 signal, the others are made followers. Every instance runs off
+ * its own crystal, off by the given ppm, i.e. both its CPU and its RTC
+ * are scaled in simulated time.
+ *
+ * The start of every second is taken from the RTC overflow IRQ of each
+ * clock; the offset of a follower is the time between its start of a
+ * second and the master's start of the same second. The summary leaves
+ * out the first minutes, until the master has synced to DCF77 and the
+ * followers to the master.
+ *
+ * The image is built with RTC_PPS=1 and -c records the PPS output of
+ * every clock the way a logic analyzer would, against simulated (true)
+ * time: the rising edges give the error of each clock, the long pulses
+ * its corrections.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_uart.h"
+#include "avr_adc.h"
+#include "avr_acomp.h"
+
+#define F_CPU           8000000UL
+#define MAX_CLOCKS      8
+#define HISTORY         128
+
+// must match firmware/minixie.h
+#define HV_R6           268000UL
+#define HV_R7           3240UL
+#define ADC_HV          4
+#define ADC_VL          5
+
+// offsets in rtc_ctx, must match firmware/rtc.c
+#define RTC_CTX_TIME    10
+#define RTC_CTX_STRETCH 24
+
+// must match PIN_PPS in firmware/rtc.h
+#define PPS_PORT        'B'
+#define PPS_BIT         0
+
+#define DCF_PULSE_0     100     // in ms
+#define DCF_PULSE_1     200     // in ms
+
+typedef struct {
+	avr_t *avr;
+	double scale;               /**< simulated seconds per cycle */
+	avr_irq_t *in;
+	char line[128];
+	int len;
+	uint32_t second[HISTORY];   /**< second of the day started ... */
+	double start[HISTORY];      /**< ... at that simulated time */
+	double pps;                 /**< last rising edge of the PPS output */
+} sim_clock_t;
+
+static sim_clock_t clocks[MAX_CLOCKS];
+static int nclocks = 3;
+static int verbose;
+static double warmup = 180;
+static uint32_t ovf_vector;
+static const char *mcu = "atmega8";
+static uint16_t rtc_ctx;
+static FILE *csv;
+static FILE *pps_csv;
+
+static struct {
+	avr_irq_t *pin;
+	uint64_t bits;
+	uint8_t second;
+	uint8_t hh, mm;
+	uint8_t pulse;
+} dcf;
+
+static struct {
+	double sum;
+	double max;
+	uint32_t count;
+} stats[MAX_CLOCKS];
+
+static double clock_time(const sim_clock_t *c)
+{
+	return c->avr->cycle * c->scale;
+}
+
+/**
+ * @brief Find the RTC overflow vector and rtc_ctx with avr-nm.
+ */
+static int load_symbols(const char *elf)
+{
+	char cmd[512], line[256], name[128];
+	// TIMER2_OVF_vect
+	const char *ovf = strcmp(mcu, "atmega8") ? "__vector_9" : "__vector_4";
+	unsigned long addr;
+	char type;
+	FILE *nm;
+
+	snprintf(cmd, sizeof(cmd), "avr-nm '%s'", elf);
+	if (!(nm = popen(cmd, "r")))
+		return -1;
+
+	while (fgets(line, sizeof(line), nm)) {
+		if (sscanf(line, "%lx %c %127s", &addr, &type, name) != 3)
+			continue;
+		if (!strcmp(name, ovf))
+			ovf_vector = addr;
+		else if (!strcmp(name, "rtc_ctx"))
+			rtc_ctx = addr & 0xFFFF;
+	}
+
+	return pclose(nm) == 0 && ovf_vector && rtc_ctx ? 0 : -1;
+}
+
+static uint16_t read16(avr_t *avr, uint16_t addr)
+{
+	return avr->data[addr] | (avr->data[addr + 1] << 8);
+}
+
+static void offset(int i, uint32_t second, double t, double t0)
+{
+	double ms = (t - t0) * 1000.0;
+
+	if (csv)
+		fprintf(csv, "%.3f,%d,%u,%.3f\n", t0, i, second, ms);
+
+	if (t0 < warmup)
+		return;
+
+	if (fabs(ms) > stats[i].max)
+		stats[i].max = fabs(ms);
+	stats[i].sum += ms;
+	stats[i].count++;
+}
+
+/**
+ * @brief Record the start of a second, at the RTC overflow IRQ.
+ */
+static void second_started(int i)
+{
+	sim_clock_t *c = &clocks[i];
+	avr_t *avr = c->avr;
+
+	// the extra overflow of a stretched second doesn't start one
+	if (avr->data[rtc_ctx + RTC_CTX_STRETCH])
+		return;
+
+	uint32_t sod = read16(avr, rtc_ctx + RTC_CTX_TIME) * 3600UL +
+				   read16(avr, rtc_ctx + RTC_CTX_TIME + 2) * 60UL +
+				   read16(avr, rtc_ctx + RTC_CTX_TIME + 4);
+	sod = (sod + 1) % 86400UL;
+
+	double t = clock_time(c);
+	c->second[sod % HISTORY] = sod;
+	c->start[sod % HISTORY] = t;
+
+	if (i == 0) {
+		for (int j = 1; j < nclocks; j++)
+			if (clocks[j].second[sod % HISTORY] == sod && clocks[j].start[sod % HISTORY] > t - 1)
+				offset(j, sod, clocks[j].start[sod % HISTORY], t);
+	} else if (clocks[0].second[sod % HISTORY] == sod && clocks[0].start[sod % HISTORY] > t - 1) {
+		offset(i, sod, t, clocks[0].start[sod % HISTORY]);
+	}
+}
+
+static uint8_t bcd(uint8_t v)
+{
+	return ((v / 10) << 4) | (v % 10);
+}
+
+static uint64_t parity(uint64_t bits, int from, int to)
+{
+	uint64_t p = 0;
+	for (int i = from; i < to; i++)
+		p ^= (bits >> i) & 1;
+	return p << to;
+}
+
+/**
+ * Frame for hh:mm on Wednesday, 2014-01-01, CET.
+ */
+static uint64_t dcf_encode(uint8_t hh, uint8_t mm)
+{
+	uint64_t bits = 0;
+
+	bits |= 1ULL << 18;
+	bits |= 1ULL << 20;
+	bits |= (uint64_t)bcd(mm) << 21;
+	bits |= parity(bits, 21, 28);
+	bits |= (uint64_t)bcd(hh) << 29;
+	bits |= parity(bits, 29, 35);
+	bits |= (uint64_t)bcd(1) << 36;
+	bits |= (uint64_t)3 << 42;
+	bits |= (uint64_t)bcd(1) << 45;
+	bits |= (uint64_t)bcd(14) << 50;
+	bits |= parity(bits, 36, 58);
+
+	return bits;
+}
+
+/**
+ * @brief DCF77 signal for the master; it runs on the master's cycles, the
+ * master's ppm is the error of the reference.
+ */
+static avr_cycle_count_t dcf_timer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	int one = (dcf.bits >> dcf.second) & 1;
+
+	if (dcf.pulse) {
+		dcf.pulse = 0;
+		avr_raise_irq(dcf.pin, 0);
+		return when + avr_usec_to_cycles(avr, (1000 - (one ? DCF_PULSE_1 : DCF_PULSE_0)) * 1000UL);
+	}
+
+	if (++dcf.second == 60) {
+		dcf.second = 0;
+		if (++dcf.mm == 60) {
+			dcf.mm = 0;
+			dcf.hh = (dcf.hh + 1) % 24;
+		}
+		dcf.bits = dcf_encode(dcf.mm == 59 ? (dcf.hh + 1) % 24 : dcf.hh, (dcf.mm + 1) % 60);
+		one = dcf.bits & 1;
+	}
+
+	if (dcf.second == 59)
+		return when + avr_usec_to_cycles(avr, 1000000UL);
+
+	dcf.pulse = 1;
+	avr_raise_irq(dcf.pin, 1);
+	return when + avr_usec_to_cycles(avr, (one ? DCF_PULSE_1 : DCF_PULSE_0) * 1000UL);
+}
+
+/**
+ * @brief Make the clock a master or a follower, once it has booted.
+ */
+static avr_cycle_count_t set_role(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	sim_clock_t *c = param;
+	const char *cmd = c == &clocks[0] ? "chain m\r" : "chain f\r";
+
+	for (; *cmd; cmd++)
+		avr_raise_irq(c->in, *cmd);
+	return 0;
+}
+
+/**
+ * Console output of a clock; the next clock gets it through the wiring.
+ */
+static void uart_out(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	sim_clock_t *c = param;
+
+	if (!verbose)
+		return;
+
+	// binary frames are not printed
+	if (value == '\n' || c->len == sizeof(c->line) - 1) {
+		c->line[c->len] = 0;
+		fprintf(stderr, "[%d %9.3f] %s\n", (int)(c - clocks), clock_time(c), c->line);
+		c->len = 0;
+	} else if (value >= ' ' && value < 0x7F) {
+		c->line[c->len++] = value;
+	}
+}
+
+/**
+ * PPS output of a clock, a row per pulse.
+ */
+static void pps_out(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	sim_clock_t *c = param;
+	double t = clock_time(c);
+
+	if (value) {
+		c->pps = t;
+	} else if (c->pps > 0) {
+		fprintf(pps_csv, "%.6f,%d,%.3f\n", c->pps, (int)(c - clocks), (t - c->pps) * 1000.0);
+		c->pps = 0;
+	}
+}
+
+static void set_input(avr_t *avr, uint32_t ctl, int index, uint32_t value)
+{
+	avr_irq_t *irq = avr_io_getirq(avr, ctl, index);
+	if (irq)
+		avr_raise_irq(irq, value);
+}
+
+static int clock_init(sim_clock_t *c, elf_firmware_t *fw, double ppm)
+{
+	avr_t *avr = avr_make_mcu_by_name(mcu);
+	uint32_t flags = 0;
+
+	if (!avr)
+		return -1;
+
+	avr_init(avr);
+	avr_load_firmware(avr, fw);
+	avr->frequency = F_CPU;
+	avr->vcc = avr->avcc = 5000;
+	avr->aref = 2560;
+	avr->log = LOG_ERROR;
+	c->avr = avr;
+	c->scale = 1.0 / (F_CPU * (1.0 + ppm * 1e-6));
+
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+	c->in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+							uart_out, c);
+	if (pps_csv)
+		avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(PPS_PORT), PPS_BIT),
+								pps_out, c);
+
+	// buttons released, supply present, HV and light in range
+	set_input(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 3, 1);
+	set_input(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 4, 1);
+	set_input(avr, AVR_IOCTL_ACOMP_GETIRQ, ACOMP_IRQ_AIN1, 2500);
+	set_input(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + ADC_HV,
+			  170 * 1000UL * HV_R7 / (HV_R6 + HV_R7));
+	set_input(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + ADC_VL, 1200);
+
+	avr_cycle_timer_register_usec(avr, 200000UL, set_role, c);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] minixie.elf\n"
+		"  -m MCU    simavr part the image was built for (atmega8)\n"
+		"  -n N      number of clocks (3)\n"
+		"  -t SEC    simulated time (300)\n"
+		"  -w SEC    left out of the summary (180)\n"
+		"  -p PPM,.. crystal error of each clock (0,50,-50)\n"
+		"  -o FILE   offsets as CSV: master time, clock, second, offset in ms\n"
+		"  -c FILE   PPS pulses as CSV: rising edge, clock, width in ms\n"
+		"  -v        print the console output of the clocks\n", prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	double ppm[MAX_CLOCKS] = {0, 50, -50, 30, -30, 20, -20, 10};
+	double seconds = 300;
+	elf_firmware_t fw;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:n:t:w:p:o:c:v")) != -1) {
+		switch (opt) {
+		case 'm': mcu = optarg; break;
+		case 'n': nclocks = atoi(optarg); break;
+		case 't': seconds = atof(optarg); break;
+		case 'w': warmup = atof(optarg); break;
+		case 'p': {
+			char *p = optarg;
+			for (int i = 0; i < MAX_CLOCKS && *p; i++) {
+				ppm[i] = strtod(p, &p);
+				if (*p == ',')
+					p++;
+			}
+			break;
+		}
+		case 'o':
+			if (!(csv = fopen(optarg, "w"))) {
+				perror(optarg);
+				return 1;
+			}
+			fprintf(csv, "time,clock,second,offset_ms\n");
+			break;
+		case 'c':
+			if (!(pps_csv = fopen(optarg, "w"))) {
+				perror(optarg);
+				return 1;
+			}
+			fprintf(pps_csv, "time,clock,width_ms\n");
+			break;
+		case 'v': verbose = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nclocks < 2 || nclocks > MAX_CLOCKS)
+		usage(argv[0]);
+
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(argv[optind], &fw)) {
+		fprintf(stderr, "can't read %s\n", argv[optind]);
+		return 1;
+	}
+	if (load_symbols(argv[optind])) {
+		fprintf(stderr, "can't find TIMER2_OVF_vect and rtc_ctx (avr-nm)\n");
+		return 1;
+	}
+
+	for (int i = 0; i < nclocks; i++)
+		if (clock_init(&clocks[i], &fw, ppm[i]))
+			return 1;
+
+	// TX of each clock to RX of the next
+	for (int i = 0; i + 1 < nclocks; i++)
+		avr_connect_irq(avr_io_getirq(clocks[i].avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+						clocks[i + 1].in);
+
+	// the signal starts at 12:00:55 so the first minute mark comes early
+	dcf.pin = avr_io_getirq(clocks[0].avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2);
+	dcf.hh = 12;
+	dcf.second = 54;
+	dcf.bits = dcf_encode(12, 1);
+	avr_raise_irq(dcf.pin, 0);
+	avr_cycle_timer_register_usec(clocks[0].avr, 300000UL, dcf_timer, NULL);
+
+	// always run the clock which is furthest behind
+	for (;;) {
+		sim_clock_t *c = &clocks[0];
+		int i = 0;
+
+		for (int j = 1; j < nclocks; j++)
+			if (clock_time(&clocks[j]) < clock_time(c))
+				c = &clocks[i = j];
+
+		if (clock_time(c) >= seconds)
+			break;
+
+		int state = avr_run(c->avr);
+		if (state == cpu_Done || state == cpu_Crashed) {
+			fprintf(stderr, "clock %d stopped at 0x%04x\n", i, c->avr->pc);
+			return 1;
+		}
+
+		if (c->avr->pc == ovf_vector)
+			second_started(i);
+	}
+
+	if (csv)
+		fclose(csv);
+	if (pps_csv)
+		fclose(pps_csv);
+
+	printf("%-6s %6s %8s %10s %10s\n", "clock", "ppm", "seconds", "mean ms", "max ms");
+	for (int i = 1; i < nclocks; i++)
+		printf("%-6d %+6.0f %8u %+10.3f %10.3f\n", i, ppm[i], stats[i].count,
+			   stats[i].count ? stats[i].sum / stats[i].count : 0, stats[i].max);
+
+	return 0;
+}
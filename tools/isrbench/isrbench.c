@@ -0,0 +1,620 @@
+/**
+ * Minixie - a simple nixie tube clock.
+ * Copyright (C) 2012-2014, Wojciech Bober
+ *
+ * License:
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/**
+ * @brief Cycle counts of the IRQ handlers and hot paths on a simulated
+ * ATmega8 or ATmega88/168/328 (simavr).
+ *
+ *     isrbench [-m mcu] [-t seconds] [-o result.json] [-a] [-f func]... minixie.elf
+ *
+ * The firmware runs with a DCF77 signal on PD2, console commands on the
+ * UART and fixed HV, light and supply voltages. Every entry to an IRQ
+ * vector or a traced function is matched with its return by the stack
+ * pointer, which gives the cycles per call:
+ * - incl: the call including its callees, less any IRQ nested in it
+ * - self: the same, less the traced callees
+ *
+ * Static functions which got inlined have no symbol of their own; they
+ * are listed as missing and are part of their caller's cycles. Build
+ * with -fno-inline-small-functions to see them separately.
+ *
+ * The result is written as JSON, see isrbench_diff.py to compare it
+ * against a baseline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_uart.h"
+#include "avr_adc.h"
+#include "avr_acomp.h"
+
+#define F_CPU           8000000UL
+#define FLASH_WORDS     (32768/2)
+#define MAX_FUNCS       256
+#define MAX_DEPTH       64
+#define MAX_CMDS        16
+
+// must match firmware/minixie.h
+#define HV_R6           268000UL
+#define HV_R7           3240UL
+#define ADC_HV          4
+#define ADC_VL          5
+
+#define DCF_PULSE_0     100     // in ms
+#define DCF_PULSE_1     200     // in ms
+#define DCF_SPIKE       2       // in ms
+
+/**
+ * @brief Functions traced by default, on top of the IRQ vectors.
+ */
+static const char *default_funcs[] = {
+	"digit_mux", "mux_next", "anode_on", "rtc_tick", "adc_cb", "pwr_hv_sample",
+	"dcf77_edge", "dcf77_poll", "dcf77_input", "dcf77_handler",
+	"dcf77_second", "dcf77_decode", "dcf_sync", "uart_rx", "uart_tx",
+	"uart_rx_cb", "uart_read", "uart_write", "log_printf",
+	"parse_command", "refresh", "rtc_snapshot", "rtc_ticks",
+	"tlm_send", "frame_write", NULL
+};
+
+/**
+ * @brief ATmega8 IRQ vector names, by vector number.
+ */
+static const char *m8_vector_names[] = {
+	"RESET", "INT0_vect", "INT1_vect", "TIMER2_COMP_vect",
+	"TIMER2_OVF_vect", "TIMER1_CAPT_vect", "TIMER1_COMPA_vect",
+	"TIMER1_COMPB_vect", "TIMER1_OVF_vect", "TIMER0_OVF_vect",
+	"SPI_STC_vect", "USART_RXC_vect", "USART_UDRE_vect",
+	"USART_TXC_vect", "ADC_vect", "EE_RDY_vect", "ANA_COMP_vect",
+	"TWI_vect", "SPM_RDY_vect", NULL
+};
+
+/**
+ * @brief ATmega88/168/328 IRQ vector names, by vector number.
+ */
+static const char *mx8_vector_names[] = {
+	"RESET", "INT0_vect", "INT1_vect", "PCINT0_vect", "PCINT1_vect",
+	"PCINT2_vect", "WDT_vect", "TIMER2_COMPA_vect", "TIMER2_COMPB_vect",
+	"TIMER2_OVF_vect", "TIMER1_CAPT_vect", "TIMER1_COMPA_vect",
+	"TIMER1_COMPB_vect", "TIMER1_OVF_vect", "TIMER0_COMPA_vect",
+	"TIMER0_COMPB_vect", "TIMER0_OVF_vect", "SPI_STC_vect",
+	"USART_RX_vect", "USART_UDRE_vect", "USART_TX_vect", "ADC_vect",
+	"EE_READY_vect", "ANALOG_COMP_vect", "TWI_vect", "SPM_READY_vect", NULL
+};
+
+static const char *mcu = "atmega8";
+static const char **vector_names = m8_vector_names;
+
+/**
+ * @brief Console commands sent by default, one every uart_period.
+ */
+static const char *default_cmds[] = {
+	"dbg on", "drift", "uart", "pwr", "dcf", "diag", NULL
+};
+
+typedef struct {
+	char name[48];
+	uint32_t addr;
+	uint8_t vector;
+	uint64_t calls;
+	uint64_t incl;
+	uint64_t self;
+	uint64_t min;
+	uint64_t max;
+} func_t;
+
+typedef struct {
+	int func;
+	uint16_t sp;
+	uint64_t start;
+	uint64_t child;     /**< cycles in traced callees */
+	uint64_t irq;       /**< cycles in nested IRQs */
+} frame_t;
+
+static struct {
+	func_t funcs[MAX_FUNCS];
+	int nfuncs;
+	int16_t entry[FLASH_WORDS];
+	frame_t stack[MAX_DEPTH];
+	int depth;
+	int vectors;
+	uint64_t isr;
+	uint64_t idle;
+} prof;
+
+static struct {
+	avr_irq_t *pin;
+	uint64_t bits;
+	uint8_t second;
+	uint8_t hh, mm;
+	uint8_t pulse, spike;
+	uint32_t spikes;
+	uint32_t edges;
+} dcf;
+
+static struct {
+	avr_irq_t *in;
+	const char *cmds[MAX_CMDS];
+	int ncmds;
+	int next;
+	uint32_t period;
+	uint32_t rx, tx;
+	int echo;
+} uart;
+
+static int trace_all;
+static const char *extra_funcs[MAX_FUNCS];
+static int nextra;
+
+static uint16_t sp_get(avr_t *avr)
+{
+	return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+static int traced(const char *name)
+{
+	if (trace_all || !strncmp(name, "__vector_", 9))
+		return 1;
+
+	for (int i = 0; default_funcs[i]; i++)
+		if (!strcmp(name, default_funcs[i]))
+			return 1;
+
+	for (int i = 0; i < nextra; i++)
+		if (!strcmp(name, extra_funcs[i]))
+			return 1;
+
+	return 0;
+}
+
+/**
+ * @brief Read the function symbols of the image with avr-nm.
+ */
+static int load_symbols(const char *elf)
+{
+	char cmd[512], line[256], name[128];
+	unsigned long addr, size;
+	char type;
+	unsigned nvec = 0;
+	FILE *nm;
+
+	memset(prof.entry, 0xFF, sizeof(prof.entry));
+	while (vector_names[nvec])
+		nvec++;
+
+	snprintf(cmd, sizeof(cmd), "avr-nm -S --defined-only '%s'", elf);
+	if (!(nm = popen(cmd, "r")))
+		return -1;
+
+	while (fgets(line, sizeof(line), nm)) {
+		if (sscanf(line, "%lx %lx %c %127s", &addr, &size, &type, name) != 4)
+			continue;
+		if (type != 'T' && type != 't' && type != 'W')
+			continue;
+		if (!traced(name) || addr / 2 >= FLASH_WORDS || prof.entry[addr / 2] >= 0)
+			continue;
+		if (prof.nfuncs == MAX_FUNCS)
+			break;
+
+		func_t *f = &prof.funcs[prof.nfuncs];
+		unsigned vec;
+
+		f->addr = addr;
+		f->min = UINT64_MAX;
+		if (sscanf(name, "__vector_%u", &vec) == 1 && vec < nvec) {
+			f->vector = 1;
+			snprintf(f->name, sizeof(f->name), "%s", vector_names[vec]);
+		} else {
+			f->vector = !strncmp(name, "__vector_", 9);
+			snprintf(f->name, sizeof(f->name), "%s", name);
+		}
+		prof.entry[addr / 2] = prof.nfuncs++;
+	}
+
+	return pclose(nm) == 0 && prof.nfuncs ? 0 : -1;
+}
+
+static void prof_pop(uint64_t now)
+{
+	frame_t *fr = &prof.stack[--prof.depth];
+	func_t *f = &prof.funcs[fr->func];
+	uint64_t incl = now - fr->start - fr->irq;
+
+	f->calls++;
+	f->incl += incl;
+	f->self += incl - fr->child;
+	if (incl < f->min)
+		f->min = incl;
+	if (incl > f->max)
+		f->max = incl;
+
+	if (f->vector && --prof.vectors == 0)
+		prof.isr += now - fr->start;
+
+	if (prof.depth) {
+		frame_t *parent = &prof.stack[prof.depth - 1];
+		if (f->vector) {
+			parent->irq += now - fr->start;
+		} else {
+			parent->child += incl;
+			parent->irq += fr->irq;
+		}
+	}
+}
+
+/**
+ * @brief Match calls and returns, run after every instruction.
+ */
+static void prof_step(avr_t *avr)
+{
+	uint16_t sp = sp_get(avr);
+
+	while (prof.depth && sp > prof.stack[prof.depth - 1].sp)
+		prof_pop(avr->cycle);
+
+	int16_t i = prof.entry[(avr->pc / 2) % FLASH_WORDS];
+	if (i < 0 || prof.depth == MAX_DEPTH)
+		return;
+
+	// a jump to the start of the current function, e.g. a loop
+	if (prof.depth && prof.stack[prof.depth - 1].func == i &&
+		prof.stack[prof.depth - 1].sp == sp)
+		return;
+
+	frame_t *fr = &prof.stack[prof.depth++];
+	fr->func = i;
+	fr->sp = sp;
+	fr->start = avr->cycle;
+	fr->child = fr->irq = 0;
+	if (prof.funcs[i].vector)
+		prof.vectors++;
+}
+
+static uint8_t bcd(uint8_t v)
+{
+	return ((v / 10) << 4) | (v % 10);
+}
+
+static uint64_t parity(uint64_t bits, int from, int to)
+{
+	uint64_t p = 0;
+	for (int i = from; i < to; i++)
+		p ^= (bits >> i) & 1;
+	return p << to;
+}
+
+/**
+ * @brief Encode the frame for the minute which starts at its next mark.
+ *
+ * The date is fixed: Wednesday, 2014-01-01, CET.
+ */
+static uint64_t dcf_encode(uint8_t hh, uint8_t mm)
+{
+	uint64_t bits = 0;
+
+	bits |= 1ULL << 18;                                 // CET
+	bits |= 1ULL << 20;                                 // start of time
+	bits |= (uint64_t)bcd(mm) << 21;
+	bits |= parity(bits, 21, 28);
+	bits |= (uint64_t)bcd(hh) << 29;
+	bits |= parity(bits, 29, 35);
+	bits |= (uint64_t)bcd(1) << 36;                     // day
+	bits |= (uint64_t)3 << 42;                          // weekday
+	bits |= (uint64_t)bcd(1) << 45;                     // month
+	bits |= (uint64_t)bcd(14) << 50;                    // year
+	bits |= parity(bits, 36, 58);
+
+	return bits;
+}
+
+static void dcf_update(void)
+{
+	avr_raise_irq(dcf.pin, dcf.pulse ^ dcf.spike);
+	dcf.edges++;
+}
+
+/**
+ * @brief Second pulses: high for 100 or 200ms, none in second 59.
+ */
+static avr_cycle_count_t dcf_timer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	if (dcf.pulse) {
+		dcf.pulse = 0;
+		dcf_update();
+		return when + avr_usec_to_cycles(avr, (1000 -
+			((dcf.bits >> dcf.second) & 1 ? DCF_PULSE_1 : DCF_PULSE_0)) * 1000UL);
+	}
+
+	if (++dcf.second == 60) {
+		dcf.second = 0;
+		if (++dcf.mm == 60) {
+			dcf.mm = 0;
+			dcf.hh = (dcf.hh + 1) % 24;
+		}
+		// the frame sent in this minute is for the next one
+		dcf.bits = dcf_encode(dcf.mm == 59 ? (dcf.hh + 1) % 24 : dcf.hh,
+							  (dcf.mm + 1) % 60);
+	}
+
+	if (dcf.second == 59)
+		return when + avr_usec_to_cycles(avr, 1000000UL);
+
+	dcf.pulse = 1;
+	dcf_update();
+	return when + avr_usec_to_cycles(avr,
+		((dcf.bits >> dcf.second) & 1 ? DCF_PULSE_1 : DCF_PULSE_0) * 1000UL);
+}
+
+/**
+ * @brief Random short spikes on the receiver output.
+ */
+static avr_cycle_count_t dcf_noise(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	dcf.spike ^= 1;
+	dcf_update();
+
+	if (dcf.spike)
+		return when + avr_usec_to_cycles(avr, DCF_SPIKE * 1000UL);
+
+	dcf.spikes++;
+	uint32_t rate = *(uint32_t *)param;
+	return when + avr_usec_to_cycles(avr, rand() % (2000000UL / rate));
+}
+
+/**
+ * @brief Send the next console command.
+ */
+static avr_cycle_count_t uart_timer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	const char *cmd = uart.cmds[uart.next];
+
+	// the first command is only sent once
+	if (++uart.next == uart.ncmds)
+		uart.next = uart.ncmds > 1 ? 1 : 0;
+
+	for (; *cmd; cmd++, uart.rx++)
+		avr_raise_irq(uart.in, *cmd);
+	avr_raise_irq(uart.in, '\r');
+	uart.rx++;
+
+	return when + avr_usec_to_cycles(avr, uart.period * 1000000UL);
+}
+
+static void uart_out(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	uart.tx++;
+	if (uart.echo)
+		fputc(value, stderr);
+}
+
+static void set_input(avr_t *avr, uint32_t ctl, int index, uint32_t value)
+{
+	avr_irq_t *irq = avr_io_getirq(avr, ctl, index);
+	if (irq)
+		avr_raise_irq(irq, value);
+}
+
+static void report(FILE *out, const char *elf, avr_t *avr, uint32_t seconds)
+{
+	uint64_t cycles = avr->cycle;
+	uint64_t busy = cycles - prof.idle;
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"elf\": \"%s\",\n", elf);
+	fprintf(out, "  \"mcu\": \"%s\",\n", mcu);
+	fprintf(out, "  \"f_cpu\": %lu,\n", F_CPU);
+	fprintf(out, "  \"seconds\": %u,\n", seconds);
+	fprintf(out, "  \"cycles\": %llu,\n", (unsigned long long)cycles);
+	fprintf(out, "  \"busy\": %llu,\n", (unsigned long long)busy);
+	fprintf(out, "  \"isr\": %llu,\n", (unsigned long long)prof.isr);
+	fprintf(out, "  \"utilization\": %.6f,\n", (double)busy / cycles);
+	fprintf(out, "  \"isr_utilization\": %.6f,\n", (double)prof.isr / cycles);
+	fprintf(out, "  \"traffic\": {\"dcf_edges\": %u, \"dcf_spikes\": %u, "
+			"\"uart_rx\": %u, \"uart_tx\": %u},\n",
+			dcf.edges, dcf.spikes, uart.rx, uart.tx);
+	fprintf(out, "  \"functions\": {");
+
+	for (int i = 0, n = 0; i < prof.nfuncs; i++) {
+		func_t *f = &prof.funcs[i];
+		if (!f->calls)
+			continue;
+		fprintf(out, "%s\n    \"%s\": {\"calls\": %llu, \"min\": %llu, "
+				"\"mean\": %.1f, \"max\": %llu, \"incl\": %llu, \"self\": %llu}",
+				n++ ? "," : "", f->name,
+				(unsigned long long)f->calls, (unsigned long long)f->min,
+				(double)f->incl / f->calls, (unsigned long long)f->max,
+				(unsigned long long)f->incl, (unsigned long long)f->self);
+	}
+
+	fprintf(out, "\n  },\n  \"missing\": [");
+	for (int i = 0, n = 0; default_funcs[i]; i++) {
+		int found = 0;
+		for (int j = 0; j < prof.nfuncs && !found; j++)
+			found = !strcmp(prof.funcs[j].name, default_funcs[i]);
+		if (!found)
+			fprintf(out, "%s\"%s\"", n++ ? ", " : "", default_funcs[i]);
+	}
+	fprintf(out, "]\n}\n");
+}
+
+static void summary(avr_t *avr)
+{
+	fprintf(stderr, "%-22s %8s %7s %9s %7s %6s\n",
+			"function", "calls", "min", "mean", "max", "cpu%");
+	for (int i = 0; i < prof.nfuncs; i++) {
+		func_t *f = &prof.funcs[i];
+		if (!f->calls)
+			continue;
+		fprintf(stderr, "%-22s %8llu %7llu %9.1f %7llu %6.2f\n", f->name,
+				(unsigned long long)f->calls, (unsigned long long)f->min,
+				(double)f->incl / f->calls, (unsigned long long)f->max,
+				100.0 * f->self / avr->cycle);
+	}
+	fprintf(stderr, "busy %.2f%%, in IRQs %.2f%%\n",
+			100.0 * (avr->cycle - prof.idle) / avr->cycle,
+			100.0 * prof.isr / avr->cycle);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] minixie.elf\n"
+		"  -m MCU    simavr part the image was built for (atmega8)\n"
+		"  -t SEC    simulated time (60)\n"
+		"  -o FILE   JSON result (stdout)\n"
+		"  -f FUNC   trace FUNC as well, may be repeated\n"
+		"  -a        trace all functions\n"
+		"  -c CMD    console command instead of the default set, may be repeated\n"
+		"  -p SEC    seconds between console commands (5)\n"
+		"  -n RATE   DCF77 spikes per second (0)\n"
+		"  -H VOLT   HV seen by the ADC (170)\n"
+		"  -v        echo the console output on stderr\n", prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t seconds = 60, noise = 0, hv = 170;
+	const char *output = NULL;
+	int opt;
+
+	uart.period = 5;
+
+	while ((opt = getopt(argc, argv, "m:t:o:f:ac:p:n:H:v")) != -1) {
+		switch (opt) {
+		case 'm': mcu = optarg; break;
+		case 't': seconds = atoi(optarg); break;
+		case 'o': output = optarg; break;
+		case 'f': if (nextra < MAX_FUNCS) extra_funcs[nextra++] = optarg; break;
+		case 'a': trace_all = 1; break;
+		case 'c': if (uart.ncmds < MAX_CMDS) uart.cmds[uart.ncmds++] = optarg; break;
+		case 'p': uart.period = atoi(optarg); break;
+		case 'n': noise = atoi(optarg); break;
+		case 'H': hv = atoi(optarg); break;
+		case 'v': uart.echo = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !seconds || !uart.period)
+		usage(argv[0]);
+
+	const char *elf = argv[optind];
+	elf_firmware_t fw;
+
+	if (strcmp(mcu, "atmega8"))
+		vector_names = mx8_vector_names;
+
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(elf, &fw)) {
+		fprintf(stderr, "can't read %s\n", elf);
+		return 1;
+	}
+	if (load_symbols(elf)) {
+		fprintf(stderr, "can't read the symbols of %s (avr-nm)\n", elf);
+		return 1;
+	}
+
+	avr_t *avr = avr_make_mcu_by_name(mcu);
+	if (!avr) {
+		fprintf(stderr, "no such part %s\n", mcu);
+		return 1;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = F_CPU;
+	avr->vcc = avr->avcc = 5000;
+	avr->aref = 2560;
+	avr->log = LOG_ERROR;
+
+	// the firmware logs are counted, not printed by simavr
+	uint32_t flags = 0;
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+	uart.in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+							uart_out, NULL);
+	if (!uart.ncmds)
+		for (; default_cmds[uart.ncmds]; uart.ncmds++)
+			uart.cmds[uart.ncmds] = default_cmds[uart.ncmds];
+
+	// buttons released, supply present, HV and light in range
+	set_input(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 3, 1);
+	set_input(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 4, 1);
+	set_input(avr, AVR_IOCTL_ACOMP_GETIRQ, ACOMP_IRQ_AIN1, 2500);
+	set_input(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + ADC_HV,
+			  hv * 1000UL * HV_R7 / (HV_R6 + HV_R7));
+	set_input(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + ADC_VL, 1200);
+
+	// the signal starts at 12:00:55 so the first minute mark comes early
+	dcf.pin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2);
+	dcf.hh = 12;
+	dcf.mm = 0;
+	dcf.second = 54;
+	dcf.bits = dcf_encode(12, 1);
+	avr_raise_irq(dcf.pin, 0);
+	avr_cycle_timer_register_usec(avr, 300000UL, dcf_timer, NULL);
+	if (noise)
+		avr_cycle_timer_register_usec(avr, 500000UL, dcf_noise, &noise);
+
+	avr_cycle_timer_register_usec(avr, 1000000UL, uart_timer, NULL);
+
+	uint64_t end = (uint64_t)seconds * F_CPU;
+	int state = cpu_Running;
+
+	while (avr->cycle < end && state != cpu_Done && state != cpu_Crashed) {
+		uint64_t before = avr->cycle;
+		int sleeping = avr->state == cpu_Sleeping;
+
+		state = avr_run(avr);
+		if (sleeping)
+			prof.idle += avr->cycle - before;
+		else
+			prof_step(avr);
+	}
+
+	if (state == cpu_Crashed) {
+		fprintf(stderr, "the firmware crashed at 0x%04x\n", avr->pc);
+		return 1;
+	}
+
+	while (prof.depth)
+		prof_pop(avr->cycle);
+
+	FILE *out = output ? fopen(output, "w") : stdout;
+	if (!out) {
+		perror(output);
+		return 1;
+	}
+	report(out, elf, avr, seconds);
+	if (out != stdout)
+		fclose(out);
+	summary(avr);
+
+	return 0;
+}
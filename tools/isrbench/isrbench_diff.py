@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""
+Minixie - a simple nixie tube clock.
+Copyright (C) 2012-2014, Wojciech Bober
+
+Compare an isrbench result against a baseline.
+
+    isrbench_diff.py baseline.json result.json --limit 5
+
+Prints the mean and max cycles per function and the CPU utilization of
+both runs. Exits with 1 if a max or the utilization grew by more than
+LIMIT percent, so it can gate a build.
+
+License: GNU GPL v2 or later, see LICENSE.
+"""
+
+import argparse
+import json
+import sys
+
+
+def change(old, new):
+    if not old:
+        return 0.0 if not new else float("inf")
+    return 100.0 * (new - old) / old
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    ap.add_argument("baseline")
+    ap.add_argument("result")
+    ap.add_argument("--limit", type=float, default=5.0,
+                    help="allowed growth in %% (default 5)")
+    args = ap.parse_args()
+
+    with open(args.baseline) as f:
+        old = json.load(f)
+    with open(args.result) as f:
+        new = json.load(f)
+
+    worse = []
+    print("%-22s %9s %9s %7s %7s %7s %7s" %
+          ("function", "mean", "was", "%", "max", "was", "%"))
+    names = sorted(set(old["functions"]) | set(new["functions"]))
+    for name in names:
+        a = old["functions"].get(name)
+        b = new["functions"].get(name)
+        if a is None or b is None:
+            print("%-22s %s" % (name, "new" if a is None else "gone"))
+            continue
+        dmax = change(a["max"], b["max"])
+        print("%-22s %9.1f %9.1f %+7.1f %7d %7d %+7.1f" %
+              (name, b["mean"], a["mean"], change(a["mean"], b["mean"]),
+               b["max"], a["max"], dmax))
+        if dmax > args.limit:
+            worse.append(name)
+
+    dutil = change(old["utilization"], new["utilization"])
+    print("utilization %.3f%% (was %.3f%%, %+.1f%%)" %
+          (100 * new["utilization"], 100 * old["utilization"], dutil))
+    if dutil > args.limit:
+        worse.append("utilization")
+
+    if worse:
+        print("over the limit: " + ", ".join(worse), file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
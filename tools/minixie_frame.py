@@ -0,0 +1,76 @@
+"""
+Minixie - a simple nixie tube clock.
+Copyright (C) 2012-2014, Wojciech Bober
+
+Binary frame reader shared by the host tools. See firmware/frame.h
+for the frame layout.
+
+License: GNU GPL v2 or later, see LICENSE.
+"""
+
+FRAME_SOF = 0xA5
+
+
+def crc_ccitt_update(crc, data):
+    """Python port of avr-libc's _crc_ccitt_update()."""
+    data ^= crc & 0xFF
+    data = (data ^ (data << 4)) & 0xFF
+    return (((data << 8) | (crc >> 8)) ^ (data >> 4) ^ (data << 3)) & 0xFFFF
+
+
+def frame_crc(body):
+    crc = 0xFFFF
+    for b in body:
+        crc = crc_ccitt_update(crc, b)
+    return crc
+
+
+def frame_encode(ftype, payload):
+    """Build a frame, e.g. to send a request to the clock."""
+    body = bytes([ftype, len(payload)]) + bytes(payload)
+    crc = frame_crc(body)
+    return bytes([FRAME_SOF]) + body + bytes([crc & 0xFF, crc >> 8])
+
+
+class FrameReader:
+    """
+    Incremental frame parser. Bytes which are not part of a valid frame
+    (the text log shares the line) are collected in `text`.
+    """
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.text = bytearray()
+        self.crc_errors = 0
+
+    def feed(self, data):
+        """Feed received bytes, return a list of (type, payload) tuples."""
+        self.buf += data
+        frames = []
+        while self.buf:
+            if self.buf[0] != FRAME_SOF:
+                self.text.append(self.buf.pop(0))
+                continue
+            if len(self.buf) < 3:
+                break
+            length = self.buf[2]
+            if len(self.buf) < length + 5:
+                break
+            body = bytes(self.buf[1:3 + length])
+            crc = self.buf[3 + length] | (self.buf[4 + length] << 8)
+            if crc != frame_crc(body):
+                self.crc_errors += 1
+                self.text.append(self.buf.pop(0))
+                continue
+            frames.append((body[0], body[2:]))
+            del self.buf[:length + 5]
+        return frames
+
+    def lines(self):
+        """Pop complete text lines received so far."""
+        out = []
+        while b"\n" in self.text:
+            line, _, rest = self.text.partition(b"\n")
+            self.text = bytearray(rest)
+            out.append(line.decode("ascii", "replace").rstrip("\r"))
+        return out
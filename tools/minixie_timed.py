@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""
+Minixie - a simple nixie tube clock.
+Copyright (C) 2012-2014, Wojciech Bober
+
+Keep serial attached clocks on the system time (HOST_SYNC=1 builds).
+
+    minixie_timed.py /dev/ttyUSB0 /dev/ttyUSB1 --poll 16
+
+Every POLL seconds each clock gets a burst of FRAME_SYNC_REQ requests.
+Every reply gives an offset and a round trip delay the NTP way; the
+offsets of the faster half of the burst are averaged and sent back in
+FRAME_SYNC_ADJ, the clock slews or steps by it. The clocks show local
+time, so the offsets are taken against the local time of day.
+
+The reply is stamped when its SOF leaves the clock and the request when
+its SOF has arrived, so the wire time of the frames is taken out before
+the delay is split in half. USB-serial adapters hold received data back
+for their latency timer (16ms on FTDI), which makes the path asymmetric;
+it is set to 1ms where sysfs allows, run as root or set it by udev.
+
+License: GNU GPL v2 or later, see LICENSE.
+"""
+
+import argparse
+import os
+import random
+import struct
+import sys
+import threading
+import time
+
+import serial
+
+from minixie_frame import FrameReader, frame_encode
+
+FRAME_SYNC_REQ = 0x03
+FRAME_SYNC_REPLY = 0x04
+FRAME_SYNC_ADJ = 0x05
+
+# must match firmware/hostsync.h
+REQ_FORMAT = "<H"
+REPLY_FORMAT = "<HII"
+ADJ_FORMAT = "<i"
+
+RTC_TICKS_PER_SEC = 256
+SECONDS_PER_DAY = 86400
+FRAME_OVERHEAD = 5
+
+
+def day_time(t):
+    """Local time of day in seconds for a Unix time."""
+    return (t + time.localtime(t).tm_gmtoff) % SECONDS_PER_DAY
+
+
+def wrap(dt):
+    """Fold a time of day difference into [-12h, 12h)."""
+    return (dt + SECONDS_PER_DAY / 2) % SECONDS_PER_DAY - SECONDS_PER_DAY / 2
+
+
+def set_latency_timer(port, ms):
+    name = os.path.basename(os.path.realpath(port))
+    path = "/sys/bus/usb-serial/devices/%s/latency_timer" % name
+    try:
+        with open(path, "w") as f:
+            f.write("%d\n" % ms)
+        return True
+    except OSError:
+        return False
+
+
+class Clock:
+    def __init__(self, port, args):
+        self.name = port
+        self.args = args
+        self.port = serial.Serial(port, args.baud, timeout=0.01)
+        self.reader = FrameReader()
+        self.byte_time = 10.0 / args.baud
+        self.seq = 0
+
+    def log(self, fmt, *values):
+        print("%s %s: %s" % (time.strftime("%H:%M:%S"), self.name, fmt % values),
+              flush=True)
+
+    def exchange(self):
+        """One request and reply, returns (offset, delay) in s or None."""
+        self.seq = (self.seq + 1) & 0xFFFF
+        request = frame_encode(FRAME_SYNC_REQ, struct.pack(REQ_FORMAT, self.seq))
+        self.port.reset_input_buffer()
+
+        t1 = time.time()
+        self.port.write(request)
+        self.port.flush()
+
+        deadline = t1 + self.args.timeout
+        while time.time() < deadline:
+            data = self.port.read(self.port.in_waiting or 1)
+            t4 = time.time()
+            for ftype, payload in self.reader.feed(data):
+                if ftype != FRAME_SYNC_REPLY or len(payload) != struct.calcsize(REPLY_FORMAT):
+                    continue
+                seq, rx, tx = struct.unpack(REPLY_FORMAT, payload)
+                if seq != self.seq:
+                    continue
+                return self.sample(t1, rx, tx, t4, len(payload) + FRAME_OVERHEAD)
+            for line in self.reader.lines():
+                if self.args.verbose:
+                    self.log("%s", line)
+        return None
+
+    def sample(self, t1, rx, tx, t4, reply_len):
+        # the request is stamped once its SOF is in, the reply when its
+        # SOF goes out; the stamps are truncated to ticks
+        t1 = day_time(t1) + self.byte_time
+        t4 = day_time(t4) - reply_len * self.byte_time
+        t2 = (rx + 0.5) / RTC_TICKS_PER_SEC
+        t3 = (tx + 0.5) / RTC_TICKS_PER_SEC
+
+        offset = (wrap(t2 - t1) + wrap(t3 - t4)) / 2
+        delay = wrap(t4 - t1) - wrap(t3 - t2)
+        return offset, delay
+
+    def poll(self):
+        samples = []
+        for _ in range(self.args.samples):
+            s = self.exchange()
+            if s is not None:
+                samples.append(s)
+            # a random phase against the clock's ticks averages out
+            # their quantization
+            time.sleep(self.args.spacing + random.random() / RTC_TICKS_PER_SEC)
+
+        if not samples:
+            self.log("no replies")
+            return
+
+        samples.sort(key=lambda s: s[1])
+        best = samples[:max(1, len(samples) // 2)]
+        offset = sum(s[0] for s in best) / len(best)
+        delay = best[0][1]
+
+        if delay > self.args.max_delay / 1000.0:
+            self.log("delay %.1fms too high, offset %+.1fms not applied",
+                     delay * 1000, offset * 1000)
+            return
+
+        adj = int(round(offset * 65536))
+        adj = max(-2**31, min(2**31 - 1, adj))
+        self.port.write(frame_encode(FRAME_SYNC_ADJ, struct.pack(ADJ_FORMAT, adj)))
+        self.log("offset %+.1fms, delay %.1fms, %d/%d replies",
+                 offset * 1000, delay * 1000, len(samples), self.args.samples)
+
+    def run(self):
+        while True:
+            start = time.time()
+            try:
+                self.poll()
+            except serial.SerialException as e:
+                self.log("%s", e)
+                return
+            time.sleep(max(0, self.args.poll - (time.time() - start)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    ap.add_argument("ports", nargs="+")
+    ap.add_argument("-b", "--baud", type=int, default=19200)
+    ap.add_argument("-p", "--poll", type=float, default=16.0,
+                    help="seconds between adjustments, not below the firmware's "
+                         "RTC_SLEW_MAX so a slew ends before the next (default 16)")
+    ap.add_argument("-n", "--samples", type=int, default=8,
+                    help="requests per adjustment (default 8)")
+    ap.add_argument("--spacing", type=float, default=0.1,
+                    help="seconds between requests (default 0.1)")
+    ap.add_argument("--timeout", type=float, default=0.5,
+                    help="reply timeout in s (default 0.5)")
+    ap.add_argument("--max-delay", type=float, default=50.0,
+                    help="skip the adjustment above this round trip in ms (default 50)")
+    ap.add_argument("-v", "--verbose", action="store_true", help="print the console output")
+    args = ap.parse_args()
+
+    clocks = []
+    for port in args.ports:
+        if not set_latency_timer(port, 1):
+            print("%s: latency timer not set" % port, file=sys.stderr)
+        clocks.append(Clock(port, args))
+
+    threads = [threading.Thread(target=c.run, daemon=True) for c in clocks]
+    for t in threads:
+        t.start()
+    try:
+        for t in threads:
+            t.join()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
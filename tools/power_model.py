@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""
+Minixie - a simple nixie tube clock.
+Copyright (C) 2012-2014, Wojciech Bober
+
+Current model of backup mode (running off the supercap C9).
+
+    power_model.py
+    power_model.py --awake-us 95 --receiver-off
+
+Backup mode is a sequence of RTC wakes, one a second. The model charges
+every wake with the time the CPU is active and what is enabled while it
+is, adds the static currents of power-save mode and prints the average
+current in uA by mode, plus the holdover time of the supercap.
+
+The awake time per wake can be measured on the clock: the `pwr` console
+command reports it (the RTC IRQ itself excluded). The device currents
+are typical figures read off the ATmega8 datasheet curves at ~4V, and
+can be overridden from the command line.
+
+This is an analytic model, not a simulation: it multiplies fixed
+durations by fixed currents. It doesn't account for
+- the currents falling with the supercap voltage, nor for temperature
+  or part to part spread,
+- the self-discharge of the supercap and the board's own loads, such
+  as the supply and HV sense dividers,
+- pins left floating or driven against a load, beyond the legacy
+  anode pin,
+- wakes other than the RTC's (UART, buttons, DCF77 edges) and the
+  actual instruction timing of the wake path.
+Use it to compare firmware variants; for the holdover time measure the
+backup current on the board.
+
+License: GNU GPL v2 or later, see LICENSE.
+"""
+
+import argparse
+
+F_CPU = 8000000
+TOSC = 1 / 32768.0
+
+# typical ATmega8 currents at ~4V, in uA
+I_ACTIVE = 8000.0       # active at 8MHz
+I_PWR_SAVE = 9.0        # power-save with the asynchronous timer running
+I_COMPARATOR = 55.0     # analog comparator enabled
+I_BANDGAP = 20.0        # bandgap reference enabled (BOD off)
+
+# board level figures, in uA
+I_RECEIVER = 80.0       # DCF77 receiver module
+I_ANODE = 300.0         # anode driver base current from a pin left high
+
+RTC_ISR_CYCLES = 250    # RTC IRQ incl. the tick callback
+
+
+def wake_model(args, legacy):
+    """
+    Return (active seconds, comparator seconds, bandgap seconds) per wake.
+    """
+    isr = RTC_ISR_CYCLES / F_CPU
+    # rtc_settle() spins for 1..2 TOSC cycles
+    settle = 1.5 * TOSC
+
+    if legacy:
+        # comparator enabled on every wake, from wake up until the next
+        # sleep, plus a 50us delay and a settle on each side of the sleep
+        loop = 50e-6 + 2 * settle + 100 / F_CPU
+        active = isr + loop
+        return active, loop, loop
+
+    if args.awake_us is not None:
+        loop = args.awake_us * 1e-6
+    else:
+        loop = settle + 80 / F_CPU
+    # the comparator runs for the bandgap settle time on polling wakes
+    poll = (args.bg_settle * 1e-6 + 40 / F_CPU) / args.poll_div
+    return isr + loop + poll, poll, poll
+
+
+def budget(args, legacy):
+    active, comp, bg = wake_model(args, legacy)
+    rows = [
+        ("power-save", I_PWR_SAVE),
+        ("cpu awake", I_ACTIVE * active),
+        ("comparator", I_COMPARATOR * comp),
+        ("bandgap", I_BANDGAP * bg),
+    ]
+    if not args.receiver_off or legacy:
+        rows.append(("dcf77 receiver", I_RECEIVER))
+    if legacy:
+        # PB5 (an anode) was not cleared on entry, so one cut in five
+        # leaves it high for the whole backup period
+        rows.append(("pins", I_ANODE / 5))
+    return rows, active
+
+
+def holdover(args, current_ua):
+    return args.cap * (args.v_start - args.v_min) / (current_ua * 1e-6)
+
+
+def report(title, args, legacy):
+    rows, active = budget(args, legacy)
+    total = sum(i for _, i in rows)
+    print("%s (awake %.0fus per wake)" % (title, active * 1e6))
+    for name, i in rows:
+        print("  %-16s %8.2f uA" % (name, i))
+    print("  %-16s %8.2f uA" % ("total", total))
+    print("  %-16s %8.1f h" % ("holdover", holdover(args, total) / 3600))
+    return total
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    ap.add_argument("--cap", type=float, default=0.1, help="supercap in F")
+    ap.add_argument("--v-start", type=float, default=4.7, help="supercap voltage at the cut")
+    ap.add_argument("--v-min", type=float, default=2.7, help="lowest voltage the clock runs at")
+    ap.add_argument("--awake-us", type=float, help="measured awake time per wake (`pwr` command)")
+    ap.add_argument("--poll-div", type=int, default=2, help="PWR_POLL_DIV")
+    ap.add_argument("--bg-settle", type=float, default=70, help="PWR_BG_SETTLE in us")
+    ap.add_argument("--receiver-off", action="store_true",
+                    help="receiver supply cut in backup (DCF_SCHED=1)")
+    args = ap.parse_args()
+
+    old = report("legacy backup loop", args, True)
+    print()
+    new = report("backup loop", args, False)
+    print()
+    print("holdover x%.2f" % (old / new))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+"""
+Minixie - a simple nixie tube clock.
+Copyright (C) 2012-2014, Wojciech Bober
+
+Fetch the PC sample histogram of a PROF=1 build and map it to functions.
+
+    prof_map.py /dev/ttyUSB0 minixie.elf [-s prof.bin]
+    prof_map.py -f prof.bin minixie.elf
+    prof_map.py /dev/ttyUSB0 minixie.elf -z parse_command
+
+Sends `prof d`, collects the FRAME_PROF frames and looks the bins up in
+the symbol table of the image (avr-nm). A bin which spans several
+functions is split between them by the bytes each one covers, so the
+figures of small functions next to hot ones are estimates; zoom in with
+-z, which narrows the bins to one function and restarts sampling, and
+dump again later.
+
+Start sampling with `prof s [step]` first; samples in sleep land in the
+function which calls sleep_mode(), usually main.
+
+License: GNU GPL v2 or later, see LICENSE.
+"""
+
+import argparse
+import subprocess
+import struct
+import sys
+import time
+
+from minixie_frame import FrameReader
+
+FRAME_PROF = 0x07
+
+# must match firmware/prof.h
+HDR_FORMAT = "<BBBBHHH"
+RTC_TICKS_PER_SEC = 256
+
+
+def collect(frames):
+    """Header and bins from a dump, None if incomplete."""
+    hdr = None
+    chunks = {}
+    for ftype, payload in frames:
+        if ftype != FRAME_PROF or not payload:
+            continue
+        if payload[0] == 0 and len(payload) == struct.calcsize(HDR_FORMAT):
+            hdr = struct.unpack(HDR_FORMAT, payload)
+            chunks = {}
+        else:
+            chunks[payload[0]] = payload[1:]
+    if hdr is None:
+        return None
+    data = b"".join(chunks[k] for k in sorted(chunks))
+    bins = [c for (c,) in struct.iter_unpack("<H", data[:len(data) // 2 * 2])]
+    if len(bins) < hdr[1]:
+        return None
+    return hdr, bins[:hdr[1]]
+
+
+def symbols(elf, nm):
+    """Functions as (start, end, name) in byte addresses, sorted."""
+    out = subprocess.run([nm, "-n", "-S", "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    funcs = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 4 and parts[2] in "TtWw":
+            start, size = int(parts[0], 16), int(parts[1], 16)
+            if size:
+                funcs.append((start, start + size, parts[3]))
+        elif len(parts) == 3 and parts[1] in "TtWw":
+            funcs.append((int(parts[0], 16), None, parts[2]))
+    funcs.sort()
+    # symbols without a size end at the next one
+    return [(s, e if e is not None else (funcs[i + 1][0] if i + 1 < len(funcs) else s + 2), n)
+            for i, (s, e, n) in enumerate(funcs)]
+
+
+def attribute(hdr, bins, funcs):
+    """Estimated samples per function, and the functions of every bin."""
+    _, nbins, shift, _, lo, _, _ = hdr
+    per_func = {}
+    per_bin = []
+    width = 2 << shift
+    for i, count in enumerate(bins):
+        start = lo * 2 + i * width
+        end = start + width
+        covered = [(max(s, start), min(e, end), n) for s, e, n in funcs if s < end and e > start]
+        per_bin.append([n for _, _, n in covered])
+        if not count:
+            continue
+        if not covered:
+            per_func["?"] = per_func.get("?", 0) + count
+            continue
+        total = sum(e - s for s, e, _ in covered)
+        for s, e, n in covered:
+            per_func[n] = per_func.get(n, 0) + count * (e - s) / total
+    return per_func, per_bin
+
+
+def fetch(args):
+    import serial
+
+    port = serial.Serial(args.port, args.baud, timeout=0.1)
+    reader = FrameReader()
+    raw = bytearray()
+    frames = []
+    port.write(b"prof d\r")
+    deadline = time.time() + args.timeout
+    result = None
+    while time.time() < deadline and result is None:
+        data = port.read(512)
+        raw += data
+        frames += reader.feed(data)
+        result = collect(frames)
+        reader.lines()
+    if result is None:
+        sys.exit("no complete profile received")
+    if args.save:
+        with open(args.save, "wb") as f:
+            f.write(raw)
+    return result
+
+
+def zoom(args, funcs, nbins):
+    """Narrow the bins to one function and restart sampling."""
+    match = [f for f in funcs if f[2] == args.zoom]
+    if not match:
+        sys.exit("%s: no such function" % args.zoom)
+    start, end, _ = match[0]
+    lo = start // 2
+    words = (end + 1) // 2 - lo
+    shift = 0
+    while (nbins << shift) < words:
+        shift += 1
+    # the console takes 14 characters
+    command = "prof r %x %d" % (lo, shift)
+    print(command)
+    if args.port:
+        import serial
+
+        port = serial.Serial(args.port, args.baud, timeout=0.5)
+        port.write(command.encode() + b"\r")
+        time.sleep(0.2)
+        port.write(b"prof s\r")
+
+
+def render(hdr, bins, funcs, show_bins, out):
+    _, nbins, shift, step, lo, samples, other = hdr
+    per_func, per_bin = attribute(hdr, bins, funcs)
+    rate = RTC_TICKS_PER_SEC / step if step else 0
+
+    print("%u samples at %.0fHz, %u outside 0x%04x-0x%04x (bins of %u bytes)" %
+          (samples, rate, other, lo * 2, lo * 2 + (nbins << (shift + 1)), 2 << shift),
+          file=out)
+    if not samples:
+        return
+
+    print("%-28s %9s %7s" % ("function", "samples", "%"), file=out)
+    for name, count in sorted(per_func.items(), key=lambda kv: -kv[1]):
+        if count >= 0.5:
+            print("%-28s %9.0f %6.1f%%" % (name, count, 100.0 * count / samples), file=out)
+    if other:
+        print("%-28s %9u %6.1f%%" % ("(outside)", other, 100.0 * other / samples), file=out)
+
+    if show_bins:
+        print(file=out)
+        for i, (count, names) in enumerate(zip(bins, per_bin)):
+            print("0x%04x %7u  %s" % ((lo << 1) + i * (2 << shift), count, " ".join(names)),
+                  file=out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    ap.add_argument("port", nargs="?")
+    ap.add_argument("elf")
+    ap.add_argument("-b", "--baud", type=int, default=19200)
+    ap.add_argument("-f", "--file", help="map a saved dump instead")
+    ap.add_argument("-s", "--save", help="save the raw dump")
+    ap.add_argument("-z", "--zoom", metavar="FUNC", help="narrow the bins to a function")
+    ap.add_argument("--bins", action="store_true", help="print the bins too")
+    ap.add_argument("--nbins", type=int, default=32, help="PROF_BINS of the build, for -z (32)")
+    ap.add_argument("--nm", default="avr-nm")
+    ap.add_argument("--timeout", type=float, default=5.0)
+    args = ap.parse_args()
+
+    funcs = symbols(args.elf, args.nm)
+
+    if args.zoom:
+        zoom(args, funcs, args.nbins)
+        return
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            result = collect(FrameReader().feed(f.read()))
+        if result is None:
+            sys.exit("%s: no complete profile" % args.file)
+    elif args.port:
+        result = fetch(args)
+    else:
+        ap.error("a port or -f is needed")
+
+    render(*result, funcs=funcs, show_bins=args.bins, out=sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+Minixie - a simple nixie tube clock.
+Copyright (C) 2012-2014, Wojciech Bober
+
+Capture the binary telemetry stream (FRAME_TLM) and write it as CSV.
+
+    tlm_capture.py /dev/ttyUSB0 --rate 100 -o tlm.csv
+
+Lost samples are detected from the sequence numbers and reported on
+stderr; the clock's own drop counter is part of every row.
+
+License: GNU GPL v2 or later, see LICENSE.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+import time
+
+import serial
+
+from minixie_frame import FrameReader
+
+FRAME_TLM = 0x01
+
+# must match tlm_sample_t in firmware/telemetry.h
+TLM_FORMAT = "<HHHBBBBBBHH"
+TLM_FIELDS = ("seq", "adc_hv", "adc_light", "duty_cycle", "dcf_state",
+              "hh", "mm", "ss", "subticks", "dcf_sync_cnt", "drops")
+
+HV_R6 = 268000
+HV_R7 = 3240
+ADC_VREF = 2560
+ADC_BITS = 1024
+
+
+def hv_from_adc(n):
+    return n * ADC_VREF / ADC_BITS * (HV_R6 + HV_R7) / HV_R7 / 1000.0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    ap.add_argument("port")
+    ap.add_argument("-b", "--baud", type=int, default=19200)
+    ap.add_argument("-r", "--rate", type=int, help="start streaming at RATE Hz")
+    ap.add_argument("-o", "--output", default="-", help="CSV file (default stdout)")
+    ap.add_argument("-n", "--count", type=int, default=0, help="stop after N samples")
+    args = ap.parse_args()
+
+    port = serial.Serial(args.port, args.baud, timeout=0.1)
+    out = sys.stdout if args.output == "-" else open(args.output, "w", newline="")
+    writer = csv.writer(out)
+    writer.writerow(("host_time",) + TLM_FIELDS + ("hv",))
+
+    if args.rate is not None:
+        port.write(b"tlm %d\r" % args.rate)
+
+    reader = FrameReader()
+    last_seq = None
+    received = lost = 0
+
+    try:
+        while not args.count or received < args.count:
+            for ftype, payload in reader.feed(port.read(512)):
+                if ftype != FRAME_TLM or len(payload) != struct.calcsize(TLM_FORMAT):
+                    continue
+                sample = struct.unpack(TLM_FORMAT, payload)
+                seq = sample[0]
+                if last_seq is not None and seq != (last_seq + 1) & 0xFFFF:
+                    gap = (seq - last_seq - 1) & 0xFFFF
+                    lost += gap
+                    print("lost %d sample(s) before #%d" % (gap, seq), file=sys.stderr)
+                last_seq = seq
+                received += 1
+                writer.writerow(("%.6f" % time.time(),) + sample +
+                                ("%.1f" % hv_from_adc(sample[1]),))
+            reader.lines()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if args.rate is not None:
+            port.write(b"tlm off\r")
+        print("%d sample(s) received, %d lost, %d CRC error(s)"
+              % (received, lost, reader.crc_errors), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
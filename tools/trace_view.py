@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+"""
+Minixie - a simple nixie tube clock.
+Copyright (C) 2012-2014, Wojciech Bober
+
+Fetch the event trace of a TRACE=1 build and print it as a timeline.
+
+    trace_view.py /dev/ttyUSB0 [-s trace.bin]
+    trace_view.py -f trace.bin
+
+Sends `trace d`, collects the FRAME_TRACE frames and prints one row per
+record with the time relative to the trigger (or the last record), the
+time since the previous record and the event in the column of its class.
+IRQ exits show the time since the matching entry. The raw frames can be
+saved and viewed again later with -f.
+
+The time base is the mux slot (32us); it wraps every 2.1s and stands
+still while the mux is stopped, so long gaps are not to scale.
+
+License: GNU GPL v2 or later, see LICENSE.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+from minixie_frame import FrameReader
+
+FRAME_TRACE = 0x06
+
+# must match firmware/trace.h
+HDR_FORMAT = "<BBBBH"
+REC_FORMAT = "<BBH"
+REC_SIZE = struct.calcsize(REC_FORMAT)
+
+CLASSES = ("IRQ", "MUX", "UART", "DCF", "EVENT", "TASK", "SLEEP", "TRIG")
+COLUMN = 11
+
+VECTORS = {1: "INT0", 2: "INT1", 3: "PPS", 4: "RTC", 9: "MUX", 11: "RXC", 12: "UDRE",
+           14: "ADC", 16: "ACOMP"}
+DCF_STATES = {0: "WAIT", 1: "SYNC", 2: "DATA_L", 3: "DATA_H"}
+# must match diag_cp_t and diag_ev_t in firmware/diag.h
+CHECKPOINTS = ("boot", "sleep", "refresh", "command", "tlm", "beep", "buttons",
+               "dcf", "frame", "resume", "backup", "reset")
+EVENTS = ("none", "pwr fail", "pwr back", "dcf sync", "rtc trim", "hv trip")
+TRIGGERS = ("console", "uart", "hv", "pwr", "storm", "reset")
+
+
+def name(table, i):
+    if isinstance(table, dict):
+        return table.get(i, str(i))
+    return table[i] if i < len(table) else str(i)
+
+
+def label(rid, arg):
+    """Text of a record, or None for an unknown id."""
+    labels = {
+        0x00: lambda: ">" + name(VECTORS, arg),
+        0x01: lambda: "<" + name(VECTORS, arg),
+        0x10: lambda: ">",
+        0x11: lambda: "<late" if arg else "<",
+        0x20: lambda: ">" + name(VECTORS, arg),
+        0x21: lambda: "<" + name(VECTORS, arg),
+        0x22: lambda: "err %02x" % arg,
+        0x30: lambda: name(DCF_STATES, arg),
+        0x31: lambda: "STORM",
+        0x40: lambda: name(EVENTS, arg),
+        0x50: lambda: name(CHECKPOINTS, arg),
+        0x51: lambda: "cmd " + (chr(arg) if 32 < arg < 127 else "%02x" % arg),
+        0x60: lambda: "sleep",
+        0x61: lambda: "wake",
+        0x70: lambda: "** " + name(TRIGGERS, arg),
+    }
+    f = labels.get(rid)
+    return f() if f else None
+
+
+def collect(frames):
+    """Header and records from a dump, None if incomplete."""
+    hdr = None
+    chunks = {}
+    for ftype, payload in frames:
+        if ftype != FRAME_TRACE or not payload:
+            continue
+        if payload[0] == 0 and len(payload) == struct.calcsize(HDR_FORMAT) + 1:
+            hdr = struct.unpack(HDR_FORMAT, payload[1:])
+            chunks = {}
+        else:
+            chunks[payload[0]] = payload[1:]
+    if hdr is None:
+        return None
+    data = b"".join(chunks[k] for k in sorted(chunks))
+    records = [struct.unpack_from(REC_FORMAT, data, i)
+               for i in range(0, len(data) - REC_SIZE + 1, REC_SIZE)]
+    if len(records) < hdr[0]:
+        return None
+    return hdr, records[:hdr[0]]
+
+
+def fetch(args):
+    import serial
+
+    port = serial.Serial(args.port, args.baud, timeout=0.1)
+    reader = FrameReader()
+    raw = bytearray()
+    frames = []
+    port.write(b"trace d\r")
+    deadline = time.time() + args.timeout
+    result = None
+    while time.time() < deadline and result is None:
+        data = port.read(512)
+        raw += data
+        frames += reader.feed(data)
+        result = collect(frames)
+        reader.lines()
+    if result is None:
+        sys.exit("no complete trace received")
+    if args.save:
+        with open(args.save, "wb") as f:
+            f.write(raw)
+    return result
+
+
+def render(hdr, records, out):
+    count, reason, mask, triggers, slot_hz = hdr
+    us = 1e6 / slot_hz
+
+    # unwrap the 16 bit slot counter
+    times = []
+    last = t = 0
+    for i, (_, _, slot) in enumerate(records):
+        if i:
+            t += (slot - last) & 0xFFFF
+        last = slot
+        times.append(t)
+
+    zero = times[-1] if times else 0
+    for (rid, arg, _), t in zip(records, times):
+        if rid == 0x70:
+            zero = t
+            break
+
+    print("%d records, mask 0x%02x, triggers 0x%02x, %s" %
+          (count, mask, triggers,
+           "trigger " + name(TRIGGERS, reason) if reason != 0xFF else "no trigger"),
+          file=out)
+    print("%10s %8s  %s" % ("t ms", "dt us", "".join(c.ljust(COLUMN) for c in CLASSES)),
+          file=out)
+
+    entered = {}
+    prev = None
+    for (rid, arg, _), t in zip(records, times):
+        cls = rid >> 4
+        text = label(rid, arg)
+        if text is None:
+            text = "?%02x %02x" % (rid, arg)
+        # IRQ exits with the time since their entry
+        if rid & 0x0F in (0, 1) and cls in (0, 1, 2):
+            key = (cls, arg if cls != 1 else 0)
+            if rid & 1 and key in entered:
+                text += " %d" % round((t - entered.pop(key)) * us)
+            elif not rid & 1:
+                entered[key] = t
+        dt = "" if prev is None else "%d" % round((t - prev) * us)
+        prev = t
+        cell = (" " * (COLUMN * min(cls, len(CLASSES) - 1)) + text)
+        print("%10.3f %8s  %s" % ((t - zero) * us / 1000.0, dt, cell), file=out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    ap.add_argument("port", nargs="?")
+    ap.add_argument("-b", "--baud", type=int, default=19200)
+    ap.add_argument("-f", "--file", help="view a saved dump instead")
+    ap.add_argument("-s", "--save", help="save the raw dump")
+    ap.add_argument("--timeout", type=float, default=5.0)
+    args = ap.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            result = collect(FrameReader().feed(f.read()))
+        if result is None:
+            sys.exit("%s: no complete trace" % args.file)
+    elif args.port:
+        result = fetch(args)
+    else:
+        ap.error("a port or -f is needed")
+
+    render(*result, out=sys.stdout)
+
+
+if __name__ == "__main__":
+    main()